@@ -1,12 +1,25 @@
 // CDmodel - Coordinate Descent class
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <windows.h>
+#include <process.h>
+
+#if defined(__AVX512F__)  ||  defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #define RESULTS 0
 
+#define GRAM_START_COLS 16  /* Initial columns allocated in the Gram cache */
+#define STRONG_RULES 1      /* Screen variables along the lambda path in lambda_train() */
+#define MAX_THREADS 64      /* Limited by WaitForMultipleObjects */
+
+struct CV_FULL ;   // Sums over the full database, shared by cross-validation folds (see cv_train())
+
 class CoordinateDescent {
 
 friend double cv_train ( int n , int nvars , int nfolds , double *xx , double *yy , double *ww ,
@@ -18,11 +31,12 @@ public:
    CoordinateDescent ( int nvars , int ncases , int weighted , int covar_updates , int n_lambda ) ;
    ~CoordinateDescent () ;
    void get_data ( int istart , int n , double *x , double *y , double *w ) ;
+   void roll_data ( int k , int n , double *x , double *y , double *w ) ;
    void core_train ( double alpha , double lambda , int maxits , double eps , int fast_test , int warm_start ) ;
    double get_lambda_thresh ( double alpha ) ;
    void lambda_train ( double alpha , int maxits , double eps , int fast_test , double max_lambda , int print_steps ) ;
 
-   int ok ;              // Was everything legal and allocs successful?
+   int ok ;              // Was everything legal and allocs successful? (Cleared by core_train() if the Gram cache cannot grow)
    double *beta ;        // Beta coefs (nvars of them)
    double explained ;    // Fraction of variance explained by model; computed by core_train()
    double *Xmeans ;      // Mean of each X predictor
@@ -42,11 +56,72 @@ private:
    double *y ;           // Normalized (mean=0, std=1) Y
    double *w ;           // Weight of each case, or NULL if equal weighting
    double *resid ;       // Residual
-   double *Xinner ;      // Nvars square inner product matrix if covar_updates
+   double *Xinner ;      // Gram cache if covar_updates: nvars rows by max_cached columns (see cache_gram())
    double *Yinner ;      // Nvars XY inner product vector if covar_updates
    double *XSSvec ;      // If cases are weighted, this is weighted X sumsquares
+   int n_cached ;        // Number of variables whose Gram columns are in Xinner
+   int max_cached ;      // Number of columns allocated in Xinner
+   int *cached ;         // The n_cached variables, ascending; column k of Xinner is for cached[k]
+   int *cache_slot ;     // Nvars; column of each variable in Xinner, or -1 if not cached
+   double *cached_beta ; // Beta of each cached variable, in the order of cached
+   double *Xcol ;        // Nvars work vector for computing a Gram column
+   int screening ;       // Is lambda_train() screening with the strong rule? (Never for direct core_train())
+   char *discard ;       // Nvars if n_lambda > 0; variables screened out for the current lambda
+   double *last_arg ;    // Nvars if n_lambda > 0; argument to S() of each variable when last visited
+   double *warm_beta ;   // Nvars if n_lambda > 0; lambda_train() copy of starting betas while screening
+   int hit_maxits ;      // Did the last core_train() stop at maxits rather than converge?
+   struct CV_FULL *full ; // If get_fold_data() was used, the full database from which the fold is downdated
+   struct CV_FULL *roll ; // If roll_data() was used, sums over the training set
+   int fold_start ;      // Index in the full database of the first training case
+   double *fold_dm ;     // Nvars if covar_updates; training mean of X minus the center of the sums
+   double *fold_wx ;     // Nvars if covar_updates; weighted training sum of X minus the center of the sums
+   double fold_w ;       // Training sum of weights (ncases if unweighted)
+   int have_path ;       // Does lambda_beta hold the path for this or the prior training set? (See roll_data())
+   double *path_prior ;  // Nvars if n_lambda > 0; lambda_train() work vector for starting from that path
+
+   int cache_gram ( int ivar ) ;
+   double zero_beta_argument ( int ivar ) ;
+   void strong_screen ( double alpha , double lambda , double prior_lambda ) ;
+   int readmit_violators ( double S_threshold ) ;
+   void get_fold_data ( int istart , int n , double *xx , double *yy , double *ww , struct CV_FULL *fs ) ;
+   void standardize_sums ( int istart , int n , double *xx , double *yy , double *ww , struct CV_FULL *ts ) ;
+   void scale_column ( int ivar ) ;
+   int full_column ( int ivar ) ;
+   int roll_column ( int ivar ) ;
+   static unsigned int __stdcall fold_thread ( void *dp ) ;
 } ;
 
+/*
+   Sums over the full database, computed once by cv_train().
+   A fold's training set is the full database minus its OOS block,
+   so its sums are these minus the sums over the OOS block.
+   Everything is centered at the full-data means to avoid cancellation.
+   The Gram columns are computed when some fold first needs them.
+   Roll_data() keeps the same sums over its moving training set.
+*/
+
+typedef struct CV_FULL {
+   int n ;               // Number of cases in full database
+   int nvars ;           // Number of variables (columns in database)
+   double *xx ;          // Full database (n rows, nvars columns)
+   double *yy ;          // Predicted variable vector, n long
+   double *ww ;          // Weights, n long, or NULL if no differential weighting
+   double *center ;      // Nvars; full-data mean of each X; all sums below are of X - center
+   double ycenter ;      // Full-data mean of Y; sums below are of Y - ycenter
+   double *sum_x ;       // Nvars; sum of X
+   double *sum_xx ;      // Nvars; sum of X squared
+   double sum_y ;        // Sum of Y
+   double sum_yy ;       // Sum of Y squared
+   double *wsum_x ;      // Nvars; weighted sum of X (unweighted if ww is NULL)
+   double *wsum_xy ;     // Nvars; weighted sum of X times Y
+   double *wsum_xx ;     // Nvars; weighted sum of X squared
+   double wsum_y ;       // Weighted sum of Y
+   double **col ;        // Nvars; weighted cross products of a variable with every variable, or NULL if not yet needed
+   CRITICAL_SECTION lock ; // Protects col
+} CV_FULL ;
+
+static void cv_full_free ( CV_FULL *fs ) ;
+
 /*
 -----------------------------------------------------------------
 
@@ -84,24 +159,51 @@ CoordinateDescent::CoordinateDescent (
    else
       w = XSSvec = NULL ;
 
-   if (covar_updates) {  // Alloc Xinner full square for faster addressing, despite symmetry
-      Xinner = (double *) malloc ( nvars * nvars * sizeof(double) ) ;
+   n_cached = 0 ;
+   if (covar_updates) {  // Xinner starts small; cache_gram() grows it as variables become active
+      max_cached = (nvars < GRAM_START_COLS)  ?  nvars : GRAM_START_COLS ;
+      Xinner = (double *) malloc ( nvars * max_cached * sizeof(double) ) ;
       Yinner = (double *) malloc ( nvars * sizeof(double) ) ;
+      cached = (int *) malloc ( nvars * sizeof(int) ) ;
+      cache_slot = (int *) malloc ( nvars * sizeof(int) ) ;
+      cached_beta = (double *) malloc ( nvars * sizeof(double) ) ;
+      Xcol = (double *) malloc ( nvars * sizeof(double) ) ;
+      fold_dm = (double *) malloc ( nvars * sizeof(double) ) ;
+      fold_wx = (double *) malloc ( nvars * sizeof(double) ) ;
       }
-   else
-      Xinner = Yinner = NULL ;
+   else {
+      max_cached = 0 ;
+      Xinner = Yinner = cached_beta = Xcol = fold_dm = fold_wx = NULL ;
+      cached = cache_slot = NULL ;
+      }
+   full = roll = NULL ;
+   fold_start = 0 ;
+   have_path = 0 ;
 
+   screening = 0 ;
+   hit_maxits = 0 ;
    if (n_lambda > 0) {
       lambda_beta = (double *) malloc ( n_lambda * nvars * sizeof(double) ) ;
       lambdas = (double *) malloc ( n_lambda * sizeof(double) ) ;
+      discard = (char *) malloc ( nvars * sizeof(char) ) ;
+      last_arg = (double *) malloc ( nvars * sizeof(double) ) ;
+      path_prior = (double *) malloc ( nvars * sizeof(double) ) ;
+      warm_beta = (double *) malloc ( nvars * sizeof(double) ) ;
+      }
+   else {
+      lambda_beta = lambdas = last_arg = path_prior = warm_beta = NULL ;
+      discard = NULL ;
       }
-   else
-      lambda_beta = lambdas = NULL ;
 
    if (x == NULL  ||  y == NULL  ||  Xmeans == NULL  ||  Xscales == NULL  ||
        beta == NULL  ||  resid == NULL  ||  (wtd && w == NULL)  ||  (wtd && XSSvec == NULL)  ||
        (covar_updates && Xinner == NULL)  ||  (covar_updates && Yinner == NULL)  ||
-       (n_lambda > 0 && lambda_beta == NULL)  ||  (n_lambda > 0 && lambdas == NULL)) {
+       (covar_updates && cached == NULL)  ||  (covar_updates && cache_slot == NULL)  ||
+       (covar_updates && cached_beta == NULL)  ||  (covar_updates && Xcol == NULL)  ||
+       (covar_updates && fold_dm == NULL)  ||  (covar_updates && fold_wx == NULL)  ||
+       (n_lambda > 0 && lambda_beta == NULL)  ||  (n_lambda > 0 && lambdas == NULL)  ||
+       (n_lambda > 0 && discard == NULL)  ||  (n_lambda > 0 && last_arg == NULL)  ||
+       (n_lambda > 0 && path_prior == NULL)  ||  (n_lambda > 0 && warm_beta == NULL)) {
       if (x != NULL) {
          free ( x ) ;
          x = NULL ;
@@ -142,6 +244,30 @@ CoordinateDescent::CoordinateDescent (
          free ( Yinner ) ;
          Yinner = NULL ;
          }
+      if (cached != NULL) {
+         free ( cached ) ;
+         cached = NULL ;
+         }
+      if (cache_slot != NULL) {
+         free ( cache_slot ) ;
+         cache_slot = NULL ;
+         }
+      if (cached_beta != NULL) {
+         free ( cached_beta ) ;
+         cached_beta = NULL ;
+         }
+      if (Xcol != NULL) {
+         free ( Xcol ) ;
+         Xcol = NULL ;
+         }
+      if (fold_dm != NULL) {
+         free ( fold_dm ) ;
+         fold_dm = NULL ;
+         }
+      if (fold_wx != NULL) {
+         free ( fold_wx ) ;
+         fold_wx = NULL ;
+         }
       if (lambda_beta != NULL) {
          free ( lambda_beta ) ;
          lambda_beta = NULL ;
@@ -150,6 +276,22 @@ CoordinateDescent::CoordinateDescent (
          free ( lambdas ) ;
          lambdas = NULL ;
          }
+      if (discard != NULL) {
+         free ( discard ) ;
+         discard = NULL ;
+         }
+      if (last_arg != NULL) {
+         free ( last_arg ) ;
+         last_arg = NULL ;
+         }
+      if (path_prior != NULL) {
+         free ( path_prior ) ;
+         path_prior = NULL ;
+         }
+      if (warm_beta != NULL) {
+         free ( warm_beta ) ;
+         warm_beta = NULL ;
+         }
       ok = 0 ;
       return ;
       }
@@ -178,10 +320,34 @@ CoordinateDescent::~CoordinateDescent ()
       free ( Xinner ) ;
    if (Yinner != NULL)
       free ( Yinner ) ;
+   if (cached != NULL)
+      free ( cached ) ;
+   if (cache_slot != NULL)
+      free ( cache_slot ) ;
+   if (cached_beta != NULL)
+      free ( cached_beta ) ;
+   if (Xcol != NULL)
+      free ( Xcol ) ;
+   if (fold_dm != NULL)
+      free ( fold_dm ) ;
+   if (fold_wx != NULL)
+      free ( fold_wx ) ;
    if (lambda_beta != NULL)
       free ( lambda_beta ) ;
    if (lambdas != NULL)
       free ( lambdas ) ;
+   if (discard != NULL)
+      free ( discard ) ;
+   if (last_arg != NULL)
+      free ( last_arg ) ;
+   if (path_prior != NULL)
+      free ( path_prior ) ;
+   if (warm_beta != NULL)
+      free ( warm_beta ) ;
+   if (roll != NULL) {
+      cv_full_free ( roll ) ;
+      free ( roll ) ;
+      }
 }
 
 
@@ -202,9 +368,19 @@ void CoordinateDescent::get_data (
    double *ww     // Case weights (n long) or NULL if no weighting
    )
 {
-   int icase, ivar, jvar, k ;
+   int icase, ivar, k ;
    double sum, xm, xs, diff, *xptr ;
 
+   full = NULL ;   // Gram columns are computed from this data
+   fold_start = istart ;
+   have_path = 0 ;
+
+   if (roll != NULL) {   // Sums kept by roll_data() are for other data
+      cv_full_free ( roll ) ;
+      free ( roll ) ;
+      roll = NULL ;
+      }
+
 /*
    Standardize X
 */
@@ -284,17 +460,16 @@ void CoordinateDescent::get_data (
       }
 
 /*
-   If user requests covariance updates, compute required inner products
-   We store the full Xinner matrix for faster addressing later,
-   even though it is symmetric.
+   If user requests covariance updates, compute the XY inner products.
+   The XX inner products (Gram matrix) are not computed here.
+   Only variables that become active ever need their column, so
+   core_train() computes them as needed.  See cache_gram().
    We handle both unweighted and weighted cases here.
 */
 
    if (covar_updates) {
       for (ivar=0 ; ivar<nvars ; ivar++) {
          xptr = x + ivar ;
-
-         // Do XiY
          sum = 0.0 ;
          if (w != NULL) {  // Weighted cases
             for (icase=0 ; icase<ncases ; icase++)
@@ -306,42 +481,803 @@ void CoordinateDescent::get_data (
                sum += xptr[icase*nvars] * y[icase] ;
             Yinner[ivar] = sum / ncases ;
             }
+         cache_slot[ivar] = -1 ;   // New data, so nothing is cached yet
+         } // For ivar
+      n_cached = 0 ;
+      }
+}
 
-         // Do XiXj
-         if (w != NULL) {  // Weighted
-            for (jvar=0 ; jvar<nvars ; jvar++) {
-               if (jvar == ivar)
-                  Xinner[ivar*nvars+jvar] = XSSvec[ivar] ; // Already computed, so might as well use it
-               else if (jvar < ivar)                       // Matrix is symmetric, so just copy
-                  Xinner[ivar*nvars+jvar] = Xinner[jvar*nvars+ivar] ;
-               else {
-                  sum = 0.0 ;
-                  for (icase=0 ; icase<ncases ; icase++)
-                     sum += w[icase] * xptr[icase*nvars] * x[icase*nvars+jvar] ;
-                  Xinner[ivar*nvars+jvar] = sum ;
-                  }               
-               }
-            } // If w
-
-         else {  // Unweighted
-            for (jvar=0 ; jvar<nvars ; jvar++) {
-               if (jvar == ivar)
-                  Xinner[ivar*nvars+jvar] = 1.0 ;      // Recall that X is standardized
-               else if (jvar < ivar)                   // Matrix is symmetric, so just copy
-                  Xinner[ivar*nvars+jvar] = Xinner[jvar*nvars+ivar] ;
-               else {
-                  sum = 0.0 ;
-                  for (icase=0 ; icase<ncases ; icase++)
-                     sum += xptr[icase*nvars] * x[icase*nvars+jvar] ;
-                  Xinner[ivar*nvars+jvar] = sum / ncases ;
-                  }
+
+/*
+-----------------------------------------------------------------
+
+   Routines for the sums over the full database used by
+   cross-validation folds
+
+-----------------------------------------------------------------
+*/
+
+static void cv_full_free ( CV_FULL *fs )
+{
+   int ivar ;
+
+   if (fs->col != NULL) {
+      for (ivar=0 ; ivar<fs->nvars ; ivar++) {
+         if (fs->col[ivar] != NULL)
+            free ( fs->col[ivar] ) ;
+         }
+      free ( fs->col ) ;
+      }
+   if (fs->center != NULL)
+      free ( fs->center ) ;
+   DeleteCriticalSection ( &fs->lock ) ;
+}
+
+static int cv_full_alloc ( CV_FULL *fs , int n , int nvars , double *xx , double *yy , double *ww )
+{
+   int ivar ;
+
+   fs->n = n ;
+   fs->nvars = nvars ;
+   fs->xx = xx ;
+   fs->yy = yy ;
+   fs->ww = ww ;
+   InitializeCriticalSection ( &fs->lock ) ;
+
+   fs->col = (double **) malloc ( nvars * sizeof(double *) ) ;
+   fs->center = (double *) malloc ( 6 * nvars * sizeof(double) ) ;
+   if (fs->col == NULL  ||  fs->center == NULL) {
+      if (fs->col != NULL)
+         free ( fs->col ) ;
+      fs->col = NULL ;
+      cv_full_free ( fs ) ;
+      return 0 ;
+      }
+   fs->sum_x = fs->center + nvars ;
+   fs->sum_xx = fs->sum_x + nvars ;
+   fs->wsum_x = fs->sum_xx + nvars ;
+   fs->wsum_xy = fs->wsum_x + nvars ;
+   fs->wsum_xx = fs->wsum_xy + nvars ;
+
+   for (ivar=0 ; ivar<6*nvars ; ivar++)
+      fs->center[ivar] = 0.0 ;
+   for (ivar=0 ; ivar<nvars ; ivar++)
+      fs->col[ivar] = NULL ;
+   fs->sum_y = fs->sum_yy = fs->wsum_y = 0.0 ;
+
+   return 1 ;
+}
+
+/*
+   Add (sign=1) or subtract (sign=-1) the k cases starting at istart
+   (wrapping) to the sums and to every Gram column that has been computed
+*/
+
+static void cv_full_update ( CV_FULL *fs , int istart , int k , double sign )
+{
+   int icase, ivar, jvar, m, nvars ;
+   double wt, d, e, di, *xptr, *center, *col ;
+
+   nvars = fs->nvars ;
+   center = fs->center ;
+
+   for (icase=0 ; icase<k ; icase++) {
+      m = (istart + icase) % fs->n ;
+      xptr = fs->xx + m * nvars ;
+      wt = sign * ((fs->ww != NULL)  ?  fs->ww[m] : 1.0) ;
+      e = fs->yy[m] - fs->ycenter ;
+      fs->sum_y += sign * e ;
+      fs->sum_yy += sign * e * e ;
+      fs->wsum_y += wt * e ;
+      for (ivar=0 ; ivar<nvars ; ivar++) {
+         d = xptr[ivar] - center[ivar] ;
+         fs->sum_x[ivar] += sign * d ;
+         fs->sum_xx[ivar] += sign * d * d ;
+         fs->wsum_x[ivar] += wt * d ;
+         fs->wsum_xy[ivar] += wt * d * e ;
+         fs->wsum_xx[ivar] += wt * d * d ;
+         }
+      for (ivar=0 ; ivar<nvars ; ivar++) {
+         col = fs->col[ivar] ;
+         if (col == NULL)
+            continue ;
+         di = wt * (xptr[ivar] - center[ivar]) ;
+         for (jvar=0 ; jvar<nvars ; jvar++)
+            col[jvar] += di * (xptr[jvar] - center[jvar]) ;
+         }
+      }
+}
+
+static int cv_full_init ( CV_FULL *fs , int n , int nvars , double *xx , double *yy , double *ww )
+{
+   int icase, ivar ;
+   double *xptr ;
+
+   if (! cv_full_alloc ( fs , n , nvars , xx , yy , ww ))
+      return 0 ;
+
+/*
+   The centers are the means
+*/
+
+   fs->ycenter = 0.0 ;
+   for (icase=0 ; icase<n ; icase++) {
+      xptr = xx + icase * nvars ;
+      for (ivar=0 ; ivar<nvars ; ivar++)
+         fs->center[ivar] += xptr[ivar] ;
+      fs->ycenter += yy[icase] ;
+      }
+   for (ivar=0 ; ivar<nvars ; ivar++)
+      fs->center[ivar] /= n ;
+   fs->ycenter /= n ;
+
+/*
+   Sums of the centered data
+*/
+
+   cv_full_update ( fs , 0 , n , 1.0 ) ;
+
+   return 1 ;
+}
+
+/*
+   Weighted cross products of centered variable ivar with every centered variable,
+   summed over the k cases starting at istart (wrapping).
+   Returns NULL if insufficient memory.
+*/
+
+static double *cv_full_column ( CV_FULL *fs , int ivar , int istart , int k )
+{
+   int icase, jvar, m, nvars ;
+   double di, *col, *xptr, *center ;
+
+   nvars = fs->nvars ;
+   center = fs->center ;
+   col = (double *) malloc ( nvars * sizeof(double) ) ;
+   if (col == NULL)
+      return NULL ;
+
+   for (jvar=0 ; jvar<nvars ; jvar++)
+      col[jvar] = 0.0 ;
+
+   for (icase=0 ; icase<k ; icase++) {
+      m = (istart + icase) % fs->n ;
+      xptr = fs->xx + m * nvars ;
+      di = xptr[ivar] - center[ivar] ;
+      if (fs->ww != NULL)
+         di *= fs->ww[m] ;
+      for (jvar=0 ; jvar<nvars ; jvar++)
+         col[jvar] += di * (xptr[jvar] - center[jvar]) ;
+      }
+
+   return col ;
+}
+
+
+/*
+-----------------------------------------------------------------
+
+   Standardize the training set from its sums
+
+   This does the same job as get_data(), except that the means,
+   standard deviations and XY inner products come from sums over
+   the training set (in ts) instead of being summed here.
+   Get_fold_data() and roll_data() get these sums cheaply.
+   The training set is the ncases starting at istart in the database,
+   wrapping back to its start if needed.
+   This also saves what scale_column() needs to get a Gram column
+   from a column of weighted cross products in the same sums.
+
+-----------------------------------------------------------------
+*/
+
+void CoordinateDescent::standardize_sums (
+   int istart ,   // Starting index in full database for getting ncases of training set
+   int n ,        // Number of cases in full database (we wrap back to the start if needed)
+   double *xx ,   // Full database (n rows, nvars columns)
+   double *yy ,   // Predicted variable vector, n long
+   double *ww ,   // Case weights (n long) or NULL if no weighting
+   CV_FULL *ts    // Sums over the training set
+   )
+{
+   int icase, ivar, k ;
+   double sum, d, e, dm, ym, ss, *xptr ;
+
+   fold_start = istart ;
+
+/*
+   Means and standard deviations of the training set, unweighted as in get_data()
+*/
+
+   ym = ts->sum_y / ncases ;                      // Training mean of Y - ycenter
+   ss = ts->sum_yy - ncases * ym * ym ;
+   if (ss < 0.0)                                  // Possible only from rounding error
+      ss = 0.0 ;
+   Ymean = ts->ycenter + ym ;
+   Yscale = sqrt ( (1.e-60 + ss) / ncases ) ;     // 1.e-60 prevents division by zero later
+
+   for (ivar=0 ; ivar<nvars ; ivar++) {
+      dm = ts->sum_x[ivar] / ncases ;
+      ss = ts->sum_xx[ivar] - ncases * dm * dm ;
+      if (ss < 0.0)
+         ss = 0.0 ;
+      Xmeans[ivar] = ts->center[ivar] + dm ;
+      Xscales[ivar] = sqrt ( (1.e-60 + ss) / ncases ) ;
+      }
+
+/*
+   Standardize X and Y
+*/
+
+   for (icase=0 ; icase<ncases ; icase++) {
+      k = (icase + istart) % n ;
+      xptr = xx + k * nvars ;
+      for (ivar=0 ; ivar<nvars ; ivar++)
+         x[icase*nvars+ivar] = (xptr[ivar] - Xmeans[ivar]) / Xscales[ivar] ;
+      y[icase] = (yy[k] - Ymean) / Yscale ;
+      }
+
+/*
+   If weighted, scale weights to sum to 1.0.
+   The weighted sums below are of the unscaled weights, so we divide by their sum.
+*/
+
+   if (w != NULL) {
+      assert ( ww != NULL) ;
+      sum = 0.0 ;
+      for (icase=0 ; icase<ncases ; icase++) {
+         k = (icase + istart) % n ;
+         w[icase] = ww[k] ;
+         sum += w[icase] ;
+         }
+      for (icase=0 ; icase<ncases ; icase++)
+         w[icase] /= sum ;
+      fold_w = sum ;
+      }
+   else
+      fold_w = ncases ;   // Unweighted inner products are divided by ncases
+
+/*
+   The weighted sum of squares of standardized X, and XY inner products.
+   With A, Q and P the training sums of w*X, w*X*X and w*X*Y,
+   the sum of w * (X - Xmean) * (Y - Ymean) is P - Ymean A - Xmean B + Xmean Ymean W,
+   where B and W are the training sums of w*Y and w.
+   Everything here is relative to the centers, so the means are dm and ym.
+*/
+
+   for (ivar=0 ; ivar<nvars ; ivar++) {
+      dm = ts->sum_x[ivar] / ncases ;
+      d = ts->wsum_x[ivar] ;   // A
+      if (w != NULL) {
+         ss = ts->wsum_xx[ivar] - 2.0 * dm * d + dm * dm * fold_w ;
+         XSSvec[ivar] = ss / (fold_w * Xscales[ivar] * Xscales[ivar]) ;
+         }
+      if (covar_updates) {
+         fold_dm[ivar] = dm ;
+         fold_wx[ivar] = d ;
+         e = ts->wsum_xy[ivar] - ym * d - dm * ts->wsum_y + dm * ym * fold_w ;
+         Yinner[ivar] = e / (fold_w * Xscales[ivar] * Yscale) ;
+         }
+      }
+}
+
+
+/*
+-----------------------------------------------------------------
+
+   Get and standardize the training set of a cross-validation fold
+
+   The training set is the ncases starting at istart, wrapping back to
+   the start of the database if needed, and the OOS block is the rest.
+   Its sums are the sums over the full database (in fs) minus those
+   over the OOS block, which is much smaller.  So the training set is
+   never summed, neither here nor for the Gram columns (full_column()).
+
+-----------------------------------------------------------------
+*/
+
+void CoordinateDescent::get_fold_data (
+   int istart ,   // Starting index in full database for getting ncases of training set
+   int n ,        // Number of cases in full database (we wrap back to the start if needed)
+   double *xx ,   // Full database (n rows, nvars columns)
+   double *yy ,   // Predicted variable vector, n long
+   double *ww ,   // Case weights (n long) or NULL if no weighting
+   CV_FULL *fs    // Sums over the full database
+   )
+{
+   int icase, ivar, k, n_OOS ;
+   double wt, d, e, *xptr, *sums ;
+   double *oos_x, *oos_xx, *oos_wx, *oos_wxy, *oos_wxx, oos_y, oos_yy, oos_wy ;
+   CV_FULL ts ;
+
+   full = fs ;
+   have_path = 0 ;
+   n_OOS = n - ncases ;
+
+   sums = (double *) malloc ( 10 * nvars * sizeof(double) ) ;
+   if (sums == NULL) {
+      ok = 0 ;
+      return ;
+      }
+   oos_x = sums ;
+   oos_xx = oos_x + nvars ;
+   oos_wx = oos_xx + nvars ;
+   oos_wxy = oos_wx + nvars ;
+   oos_wxx = oos_wxy + nvars ;
+
+/*
+   Sum the OOS block, centered as the full sums are
+*/
+
+   for (ivar=0 ; ivar<5*nvars ; ivar++)
+      sums[ivar] = 0.0 ;
+   oos_y = oos_yy = oos_wy = 0.0 ;
+
+   for (icase=0 ; icase<n_OOS ; icase++) {
+      k = (istart + ncases + icase) % n ;
+      xptr = xx + k * nvars ;
+      wt = (ww != NULL)  ?  ww[k] : 1.0 ;
+      e = yy[k] - fs->ycenter ;
+      oos_y += e ;
+      oos_yy += e * e ;
+      oos_wy += wt * e ;
+      for (ivar=0 ; ivar<nvars ; ivar++) {
+         d = xptr[ivar] - fs->center[ivar] ;
+         oos_x[ivar] += d ;
+         oos_xx[ivar] += d * d ;
+         oos_wx[ivar] += wt * d ;
+         oos_wxy[ivar] += wt * d * e ;
+         oos_wxx[ivar] += wt * d * d ;
+         }
+      }
+
+/*
+   The training sums are the full sums minus the OOS sums
+*/
+
+   ts.center = fs->center ;
+   ts.ycenter = fs->ycenter ;
+   ts.sum_x = oos_wxx + nvars ;
+   ts.sum_xx = ts.sum_x + nvars ;
+   ts.wsum_x = ts.sum_xx + nvars ;
+   ts.wsum_xy = ts.wsum_x + nvars ;
+   ts.wsum_xx = ts.wsum_xy + nvars ;
+   ts.sum_y = fs->sum_y - oos_y ;
+   ts.sum_yy = fs->sum_yy - oos_yy ;
+   ts.wsum_y = fs->wsum_y - oos_wy ;
+   for (ivar=0 ; ivar<nvars ; ivar++) {
+      ts.sum_x[ivar] = fs->sum_x[ivar] - oos_x[ivar] ;
+      ts.sum_xx[ivar] = fs->sum_xx[ivar] - oos_xx[ivar] ;
+      ts.wsum_x[ivar] = fs->wsum_x[ivar] - oos_wx[ivar] ;
+      ts.wsum_xy[ivar] = fs->wsum_xy[ivar] - oos_wxy[ivar] ;
+      ts.wsum_xx[ivar] = fs->wsum_xx[ivar] - oos_wxx[ivar] ;
+      }
+
+   standardize_sums ( istart , n , xx , yy , ww , &ts ) ;
+
+   if (covar_updates) {
+      for (ivar=0 ; ivar<nvars ; ivar++)
+         cache_slot[ivar] = -1 ;   // New data, so nothing is cached yet
+      }
+   n_cached = 0 ;
+
+   free ( sums ) ;
+}
+
+
+/*
+-----------------------------------------------------------------
+
+   Gram column from weighted cross products
+
+   On entry, Xcol holds the weighted cross products of ivar with every
+   variable over the training set, centered as the sums given to
+   standardize_sums().  We center and scale them as in that routine.
+   The result is what cache_gram() would have computed directly.
+
+-----------------------------------------------------------------
+*/
+
+void CoordinateDescent::scale_column ( int ivar )
+{
+   int jvar ;
+   double denom ;
+
+   for (jvar=0 ; jvar<nvars ; jvar++) {
+      denom = fold_w * Xscales[ivar] * Xscales[jvar] ;
+      Xcol[jvar] = (Xcol[jvar] - fold_dm[ivar] * fold_wx[jvar] - fold_dm[jvar] * fold_wx[ivar]
+                  + fold_dm[ivar] * fold_dm[jvar] * fold_w) / denom ;
+      }
+
+   if (w != NULL)
+      Xcol[ivar] = XSSvec[ivar] ;
+   else
+      Xcol[ivar] = 1.0 ;            // Recall that X is standardized
+}
+
+
+/*
+-----------------------------------------------------------------
+
+   Gram column of a cross-validation fold (see get_fold_data())
+
+   The full database's weighted cross products of ivar with every
+   variable are computed by the first fold that needs them, and then
+   kept for all folds.  We subtract the OOS block's cross products
+   and scale the result into Xcol.
+   This returns 0 if there was insufficient memory, else 1.
+
+-----------------------------------------------------------------
+*/
+
+int CoordinateDescent::full_column ( int ivar )
+{
+   int icase, jvar, k, n_OOS ;
+   double di, *col, *xptr, *center ;
+
+   EnterCriticalSection ( &full->lock ) ;
+   if (full->col[ivar] == NULL)
+      full->col[ivar] = cv_full_column ( full , ivar , 0 , full->n ) ;
+   col = full->col[ivar] ;
+   LeaveCriticalSection ( &full->lock ) ;
+   if (col == NULL)
+      return 0 ;
+
+   center = full->center ;
+   for (jvar=0 ; jvar<nvars ; jvar++)
+      Xcol[jvar] = col[jvar] ;
+
+   n_OOS = full->n - ncases ;
+   for (icase=0 ; icase<n_OOS ; icase++) {
+      k = (fold_start + ncases + icase) % full->n ;
+      xptr = full->xx + k * nvars ;
+      di = xptr[ivar] - center[ivar] ;
+      if (full->ww != NULL)
+         di *= full->ww[k] ;
+      for (jvar=0 ; jvar<nvars ; jvar++)
+         Xcol[jvar] -= di * (xptr[jvar] - center[jvar]) ;
+      }
+
+   scale_column ( ivar ) ;
+   return 1 ;
+}
+
+
+/*
+-----------------------------------------------------------------
+
+   Move the training set forward for walk-forward retraining
+
+   The training set fetched by get_data() (or a prior roll_data()) is
+   moved k cases later in the same database: its first k cases are
+   dropped and the k after its end are added.  Rather than summing the
+   new training set, we keep sums over it, starting from the first call,
+   and subtract and add the k cases.  The Gram columns of the cached
+   variables are kept the same way, so the cache survives the move.
+   The standardized copy of X must still be rewritten, as every value
+   changes when the means do, but it is a single pass.
+
+   The sums are centered at the means of the training set at the first
+   call, so if the data drifts far from these over a very long walk,
+   calling get_data() again starts over with new centers.
+
+   After this, lambda_train() starts each lambda from the path for the
+   prior training set, moved by as much as the new path has moved from
+   it at the prior lambda.  This starts closer than either path alone.
+   Core_train() with warm_start simply starts from the current betas.
+
+-----------------------------------------------------------------
+*/
+
+void CoordinateDescent::roll_data (
+   int k ,        // Number of cases to move forward, typically much less than ncases
+   int n ,        // Number of cases in full database (we wrap back to the start if needed)
+   double *xx ,   // Full database (n rows, nvars columns)
+   double *yy ,   // Predicted variable vector, n long
+   double *ww     // Case weights (n long) or NULL if no weighting
+   )
+{
+   int i, ivar, jvar ;
+   double wsum, *col ;
+
+   assert ( k >= 0 ) ;
+   full = NULL ;
+   if (w == NULL)   // As in get_data(), weights are ignored if the model is unweighted
+      ww = NULL ;
+
+/*
+   The first time, sum the current training set, centered at its means.
+   The cached Gram columns are unscaled to weighted cross products.
+*/
+
+   if (roll == NULL) {
+      roll = (CV_FULL *) malloc ( sizeof(CV_FULL) ) ;
+      if (roll == NULL  ||  ! cv_full_alloc ( roll , n , nvars , xx , yy , ww )) {
+         if (roll != NULL)
+            free ( roll ) ;
+         roll = NULL ;
+         ok = 0 ;
+         return ;
+         }
+
+      for (ivar=0 ; ivar<nvars ; ivar++)
+         roll->center[ivar] = Xmeans[ivar] ;
+      roll->ycenter = Ymean ;
+      cv_full_update ( roll , fold_start , ncases , 1.0 ) ;
+
+      if (covar_updates) {
+         if (w != NULL) {
+            wsum = 0.0 ;
+            for (i=0 ; i<ncases ; i++)
+               wsum += ww[(fold_start+i)%n] ;
+            }
+         else
+            wsum = ncases ;
+         for (i=0 ; i<n_cached ; i++) {
+            ivar = cached[i] ;
+            col = (double *) malloc ( nvars * sizeof(double) ) ;
+            if (col == NULL) {
+               ok = 0 ;
+               return ;
                }
-            } // Else not weighted
-         } // For ivar
+            for (jvar=0 ; jvar<nvars ; jvar++)
+               col[jvar] = Xinner[jvar*max_cached+i] * wsum * Xscales[ivar] * Xscales[jvar] ;
+            roll->col[ivar] = col ;
+            }
+         }
+      }
+
+/*
+   Drop the first k cases and add the k after the end
+*/
+
+   roll->xx = xx ;
+   roll->yy = yy ;
+   roll->ww = ww ;
+   cv_full_update ( roll , fold_start , k , -1.0 ) ;
+   cv_full_update ( roll , fold_start + ncases , k , 1.0 ) ;
+
+   standardize_sums ( (fold_start + k) % n , n , xx , yy , ww , roll ) ;
+
+/*
+   Rescale the cached Gram columns
+*/
+
+   if (covar_updates) {
+      for (i=0 ; i<n_cached ; i++) {
+         ivar = cached[i] ;
+         for (jvar=0 ; jvar<nvars ; jvar++)
+            Xcol[jvar] = roll->col[ivar][jvar] ;
+         scale_column ( ivar ) ;
+         for (jvar=0 ; jvar<nvars ; jvar++)
+            Xinner[jvar*max_cached+i] = Xcol[jvar] ;
+         }
+      }
+}
+
+
+/*
+-----------------------------------------------------------------
+
+   Gram column of a training set moved by roll_data()
+   This returns 0 if there was insufficient memory, else 1.
+
+-----------------------------------------------------------------
+*/
+
+int CoordinateDescent::roll_column ( int ivar )
+{
+   int jvar ;
+
+   if (roll->col[ivar] == NULL) {
+      roll->col[ivar] = cv_full_column ( roll , ivar , fold_start , ncases ) ;
+      if (roll->col[ivar] == NULL)
+         return 0 ;
+      }
+
+   for (jvar=0 ; jvar<nvars ; jvar++)
+      Xcol[jvar] = roll->col[ivar][jvar] ;
+
+   scale_column ( ivar ) ;
+   return 1 ;
+}
+
+
+/*
+-----------------------------------------------------------------
+
+   Gram cache for covariance updates
+
+   The covariance update for a variable needs the inner product of its
+   X with the X of every variable having nonzero beta.  Rather than
+   computing all nvars * nvars inner products in advance, we compute
+   the column of a variable the first time its beta becomes nonzero,
+   and keep it for the life of the object (later lambdas included).
+
+   Xinner has a row for each variable, and its first n_cached columns
+   are the cached variables in ascending order.  So the dot product for
+   a variable is a contiguous sweep of its row against cached_beta.
+   Summing in ascending order of variable, and skipping only betas that
+   are exactly zero, gives exactly the sum over all variables that the
+   full matrix gave.  Each inner product is also computed with the same
+   operations in the same order as the full matrix was.
+
+   This returns 0 if there was insufficient memory, else 1.
+
+-----------------------------------------------------------------
+*/
+
+int CoordinateDescent::cache_gram ( int ivar )
+{
+   int icase, jvar, k, pos, new_max ;
+   double xi, wxi, *xptr, *new_inner, *row ;
+
+   if (cache_slot[ivar] >= 0)   // Already cached
+      return 1 ;
+
+/*
+   Compute the inner product of ivar with every variable.
+   The full matrix computed the sum for jvar>ivar as w * Xivar * Xjvar,
+   and copied it for jvar<ivar, so we preserve the order of products.
+   We sweep cases in the outer loop so that X is accessed sequentially.
+   A cross-validation fold instead gets it from the full database,
+   and a training set moved by roll_data() gets it from its sums.
+*/
+
+   if (full != NULL) {  // Cross-validation fold, so downdate from the full database
+      if (! full_column ( ivar ))
+         return 0 ;
+      }
+
+   else if (roll != NULL) {  // Training set moved by roll_data(), so use its sums
+      if (! roll_column ( ivar ))
+         return 0 ;
+      }
+
+   else {
+      for (jvar=0 ; jvar<nvars ; jvar++)
+         Xcol[jvar] = 0.0 ;
+
+      for (icase=0 ; icase<ncases ; icase++) {
+         xptr = x + icase * nvars ;
+         xi = xptr[ivar] ;
+         if (w != NULL) {  // Weighted
+            wxi = w[icase] * xi ;
+            for (jvar=0 ; jvar<ivar ; jvar++)
+               Xcol[jvar] += w[icase] * xptr[jvar] * xi ;
+            for (jvar=ivar+1 ; jvar<nvars ; jvar++)
+               Xcol[jvar] += wxi * xptr[jvar] ;
+            }
+         else {            // Unweighted
+            for (jvar=0 ; jvar<nvars ; jvar++)
+               Xcol[jvar] += xi * xptr[jvar] ;
+            }
+         }
+
+      if (w != NULL)
+         Xcol[ivar] = XSSvec[ivar] ;   // Already computed, so might as well use it
+      else {
+         for (jvar=0 ; jvar<nvars ; jvar++)
+            Xcol[jvar] /= ncases ;
+         Xcol[ivar] = 1.0 ;            // Recall that X is standardized
+         }
+      }
+
+/*
+   Make room for another column if needed
+*/
+
+   if (n_cached == max_cached) {
+      new_max = 2 * max_cached ;
+      if (new_max > nvars)
+         new_max = nvars ;
+      new_inner = (double *) malloc ( nvars * new_max * sizeof(double) ) ;
+      if (new_inner == NULL)
+         return 0 ;
+      for (jvar=0 ; jvar<nvars ; jvar++)
+         memcpy ( new_inner + jvar * new_max , Xinner + jvar * max_cached , n_cached * sizeof(double) ) ;
+      free ( Xinner ) ;
+      Xinner = new_inner ;
+      max_cached = new_max ;
+      }
+
+/*
+   Insert the column at its place in ascending order
+*/
+
+   for (pos=n_cached ; pos>0 ; pos--) {
+      if (cached[pos-1] < ivar)
+         break ;
+      }
+
+   for (k=n_cached ; k>pos ; k--) {
+      cached[k] = cached[k-1] ;
+      cached_beta[k] = cached_beta[k-1] ;
+      cache_slot[cached[k]] = k ;
       }
+   cached[pos] = ivar ;
+   cached_beta[pos] = beta[ivar] ;
+   cache_slot[ivar] = pos ;
+
+   for (jvar=0 ; jvar<nvars ; jvar++) {
+      row = Xinner + jvar * max_cached ;
+      memmove ( row + pos + 1 , row + pos , (n_cached - pos) * sizeof(double) ) ;
+      row[pos] = Xcol[jvar] ;
+      }
+
+   ++n_cached ;
+   return 1 ;
 }
 
 
+/*
+-----------------------------------------------------------------
+
+   Dot product of a row of the Gram cache with cached_beta
+
+   The SIMD kernel is selected at compile time: AVX-512 if __AVX512F__ is
+   defined (/arch:AVX512), AVX2 if __AVX2__ is defined (/arch:AVX2), and
+   otherwise a plain scalar loop.  The scalar loop adds in the order of
+   the full matrix, so its betas are identical to the original.  The SIMD
+   kernels keep several partial sums, so the last bits of the sum,
+   and hence of the betas, may differ.
+
+-----------------------------------------------------------------
+*/
+
+#if defined(__AVX512F__)
+
+static double gram_dot ( int n , double *row , double *b )
+{
+   int k ;
+   double sum ;
+   __m512d sum8 ;
+
+   sum8 = _mm512_setzero_pd () ;
+   for (k=0 ; k<n-7 ; k+=8)
+      sum8 = _mm512_add_pd ( sum8 , _mm512_mul_pd ( _mm512_loadu_pd ( row + k ) , _mm512_loadu_pd ( b + k ) ) ) ;
+
+   sum = _mm512_reduce_add_pd ( sum8 ) ;
+   for ( ; k<n ; k++)
+      sum += row[k] * b[k] ;
+   return sum ;
+}
+
+#elif defined(__AVX2__)
+
+static double gram_dot ( int n , double *row , double *b )
+{
+   int k ;
+   double sum, buf[4] ;
+   __m256d sum4 ;
+
+   sum4 = _mm256_setzero_pd () ;
+   for (k=0 ; k<n-3 ; k+=4)
+      sum4 = _mm256_add_pd ( sum4 , _mm256_mul_pd ( _mm256_loadu_pd ( row + k ) , _mm256_loadu_pd ( b + k ) ) ) ;
+
+   _mm256_storeu_pd ( buf , sum4 ) ;
+   sum = (buf[0] + buf[1]) + (buf[2] + buf[3]) ;
+   for ( ; k<n ; k++)
+      sum += row[k] * b[k] ;
+   return sum ;
+}
+
+#else
+
+static double gram_dot ( int n , double *row , double *b )
+{
+   int k ;
+   double sum ;
+
+   sum = 0.0 ;
+   for (k=0 ; k<n ; k++)
+      sum += row[k] * b[k] ;
+   return sum ;
+}
+
+#endif
+
+
 
 /*
 -----------------------------------------------------------------
@@ -367,7 +1303,7 @@ void CoordinateDescent::core_train (
    int warm_start    // Start from existing beta, rather than zero?
    )
 {
-   int i, iter, icase, ivar, kvar, do_active_only, active_set_changed, converged ;
+   int i, k, iter, icase, ivar, do_active_only, active_set_changed, converged ;
    double *xptr, residual_sum, S_threshold, argument, new_beta, correction, update_factor ;
    double sum, explained_variance, crit, prior_crit, penalty, max_change, Xss, YmeanSquare ;
 
@@ -399,6 +1335,17 @@ void CoordinateDescent::core_train (
          resid[i] = y[i] ;
       }
 
+   if (covar_updates) {             // Every nonzero beta must be in the Gram cache
+      for (ivar=0 ; ivar<nvars ; ivar++) {
+         if (beta[ivar] != 0.0  &&  ! cache_gram ( ivar )) {
+            ok = 0 ;
+            return ;
+            }
+         }
+      for (i=0 ; i<n_cached ; i++)
+         cached_beta[i] = beta[cached[i]] ;
+      }
+
    // YmeanSquare will remain fixed throughout training.
    // Its only use is for computing explained variance for the user's edification.
 
@@ -430,6 +1377,9 @@ void CoordinateDescent::core_train (
          if (do_active_only  &&  beta[ivar] == 0.0)
             continue ;
 
+         if (screening  &&  discard[ivar])   // The strong rule says it will stay at zero
+            continue ;
+
          // Denominator in update
          if (w != NULL)      // Weighted?
             Xss = XSSvec[ivar] ;
@@ -438,9 +1388,7 @@ void CoordinateDescent::core_train (
          update_factor = Xss + lambda * (1.0 - alpha) ;
 
          if (covar_updates) {   // Any sensible user will specify this unless ncases < nvars
-            sum = 0.0 ;
-            for (kvar=0 ; kvar<nvars ; kvar++)
-               sum += Xinner[ivar*nvars+kvar] * beta[kvar] ;
+            sum = gram_dot ( n_cached , Xinner + ivar * max_cached , cached_beta ) ; // Zero betas not cached
             residual_sum = Yinner[ivar] - sum ;
             argument = residual_sum + Xss * beta[ivar] ;   // Argument to S() [MY FORMULA]
             }
@@ -461,6 +1409,9 @@ void CoordinateDescent::core_train (
             argument = residual_sum + beta[ivar] ;  // Argument to S() ;    (Eq 8)
             }
 
+         if (last_arg != NULL)   // Saved for the strong rule at the next lambda
+            last_arg[ivar] = argument ;
+
          // Apply the soft-thresholding operator S()
 
          if (argument > 0.0  &&  S_threshold < argument)
@@ -486,6 +1437,13 @@ void CoordinateDescent::core_train (
             if ((beta[ivar] == 0.0  &&  new_beta != 0.0)  ||  (beta[ivar] != 0.0  &&  new_beta == 0.0))
                active_set_changed = 1 ;
             beta[ivar] = new_beta ;
+            if (covar_updates) {    // Keep the Gram cache current; a new nonzero beta needs its column
+               if (! cache_gram ( ivar )) {
+                  ok = 0 ;
+                  return ;
+                  }
+               cached_beta[cache_slot[ivar]] = new_beta ;
+               }
             }
 
          } // For all variables; a complete pass
@@ -509,8 +1467,8 @@ void CoordinateDescent::core_train (
             for (icase=0 ; icase<ncases ; icase++) {
                xptr = x + icase * nvars ;
                sum = 0.0 ;
-               for (ivar=0 ; ivar<nvars ; ivar++)
-                  sum += beta[ivar] * xptr[ivar] ; // Cumulate predicted value
+               for (k=0 ; k<n_cached ; k++)     // Only cached variables can have nonzero beta
+                  sum += cached_beta[k] * xptr[cached[k]] ; // Cumulate predicted value
                resid[icase] = y[icase] - sum ;     // Residual = true - predicted
                }
             }
@@ -560,29 +1518,38 @@ void CoordinateDescent::core_train (
          }
 
       else {                     // We just did a complete pass (all variables)
-         if (converged  &&  ! active_set_changed)
-            break ;
+         if (converged  &&  ! active_set_changed) {
+            if (! screening  ||  ! readmit_violators ( S_threshold ))
+               break ;
+            continue ;           // The strong rule was wrong for some, so do another complete pass
+            }
          do_active_only = 1 ;    // We now do an active-only pass
          }
 
       } // Outer loop iterations
 
+   hit_maxits = (iter >= maxits) ;
+
 /*
    We are done.  Compute and save the explained variance.
    If we did the fast convergence test and covariance updates,
-   we must compute the residual in order to get the explained variance.
-   Those two options do not require regular residual computation,
-   so we don't currently have the residual.
+   we don't currently have the residual, as those two options do not
+   require regular residual computation.  But we don't need it:
+   the mean squared residual is YmeanSquare - 2 beta'Yinner + beta'Xinner beta,
+   so the explained part is 2 beta'Yinner - beta'Xinner beta.  This costs
+   only the square of the number of cached variables, not a pass through
+   the cases, which matters when the model is retrained often (roll_data()).
 */
 
    if (fast_test  &&  covar_updates) {  // Residuals have not been maintained?
-      for (icase=0 ; icase<ncases ; icase++) {
-         xptr = x + icase * nvars ;
-         sum = 0.0 ;
-         for (ivar=0 ; ivar<nvars ; ivar++)
-            sum += beta[ivar] * xptr[ivar] ;
-         resid[icase] = y[icase] - sum ;
+      sum = 0.0 ;
+      for (k=0 ; k<n_cached ; k++) {    // Only cached variables can have nonzero beta
+         if (cached_beta[k] != 0.0)
+            sum += cached_beta[k] * (2.0 * Yinner[cached[k]]
+                   - gram_dot ( n_cached , Xinner + cached[k] * max_cached , cached_beta )) ;
          }
+      explained = sum / YmeanSquare ;
+      return ;
       }
 
    sum = 0.0 ;
@@ -601,6 +1568,89 @@ void CoordinateDescent::core_train (
 }
 
 
+/*
+------------------------------------------------------------------------------------------
+
+   Sequential strong rule for screening variables along the lambda path
+   (Tibshirani et al., "Strong rules for discarding predictors in lasso-type
+   problems", 2012).
+
+   Having just trained at prior_lambda, a variable whose beta is zero there
+   is very unlikely to become nonzero at the next lambda if the magnitude
+   of its argument to S() is less than alpha * (2 lambda - prior_lambda).
+   Such variables are skipped by core_train().  The rule can be wrong,
+   so after convergence core_train() checks the Kuhn-Tucker condition
+   for every discarded variable: its beta remains zero only if the
+   magnitude of its argument does not exceed the S() threshold.  Any
+   that fail are readmitted and training continues.  So the result is
+   the unscreened solution to within the convergence criterion.
+   If core_train() stops at maxits instead, that check never happened,
+   so lambda_train() trains that lambda again, unscreened, from the same
+   starting betas.
+
+   The arguments at prior_lambda cost nothing: the final complete pass
+   of core_train() saved them in last_arg for the variables it visited,
+   and the Kuhn-Tucker check saved them for the discarded variables.
+
+   zero_beta_argument() is the argument to S() of a variable whose beta
+   is zero.  The residual must be current if not covar_updates; it is
+   maintained during training and recomputed at the end of core_train().
+
+------------------------------------------------------------------------------------------
+*/
+
+double CoordinateDescent::zero_beta_argument ( int ivar )
+{
+   int icase ;
+   double sum, *xptr ;
+
+   if (covar_updates)
+      return Yinner[ivar] - gram_dot ( n_cached , Xinner + ivar * max_cached , cached_beta ) ;
+
+   xptr = x + ivar ;    // Point to column of this variable
+   sum = 0.0 ;
+   if (w != NULL) {
+      for (icase=0 ; icase<ncases ; icase++)
+         sum += w[icase] * xptr[icase*nvars] * resid[icase] ;
+      return sum ;
+      }
+   for (icase=0 ; icase<ncases ; icase++)
+      sum += xptr[icase*nvars] * resid[icase] ;
+   return sum / ncases ;
+}
+
+void CoordinateDescent::strong_screen ( double alpha , double lambda , double prior_lambda )
+{
+   int ivar ;
+   double thresh ;
+
+   thresh = alpha * (2.0 * lambda - prior_lambda) ;
+   for (ivar=0 ; ivar<nvars ; ivar++) {
+      if (beta[ivar] != 0.0)
+         discard[ivar] = 0 ;
+      else
+         discard[ivar] = (fabs ( last_arg[ivar] ) < thresh) ;
+      }
+}
+
+int CoordinateDescent::readmit_violators ( double S_threshold )
+{
+   int ivar, n ;
+
+   n = 0 ;
+   for (ivar=0 ; ivar<nvars ; ivar++) {
+      if (! discard[ivar])
+         continue ;
+      last_arg[ivar] = zero_beta_argument ( ivar ) ;
+      if (fabs ( last_arg[ivar] ) > S_threshold) {
+         discard[ivar] = 0 ;
+         ++n ;
+         }
+      }
+   return n ;
+}
+
+
 /*
 ------------------------------------------------------------------------------------------
 
@@ -618,7 +1668,9 @@ double CoordinateDescent::get_lambda_thresh ( double alpha )
    for (ivar=0 ; ivar<nvars ; ivar++) {
       xptr = x + ivar ;
       sum = 0.0 ;
-      if (w != NULL) {
+      if (covar_updates)   // Already computed this
+         sum = Yinner[ivar] ;
+      else if (w != NULL) {
          for (icase=0 ; icase<ncases ; icase++)
             sum += w[icase] * xptr[icase*nvars] * y[icase] ;
          }
@@ -654,7 +1706,7 @@ void CoordinateDescent::lambda_train (
    )
 {
    int ivar, ilambda, n_active ;
-   double lambda, min_lambda, lambda_factor ;
+   double lambda, min_lambda, lambda_factor, b, step ;
    FILE *fp_results ;
 
    if (print_steps) {
@@ -688,7 +1740,39 @@ void CoordinateDescent::lambda_train (
    lambda = max_lambda ;
    for (ilambda=0 ; ilambda<n_lambda ; ilambda++) {
       lambdas[ilambda] = lambda ;   // Save in case we want to use later
-      core_train ( alpha , lambda , maxits , eps , fast_test , ilambda ) ;
+      if (have_path) {              // Start from the path for the prior training set (see roll_data())
+         for (ivar=0 ; ivar<nvars ; ivar++) {
+            b = lambda_beta[ilambda*nvars+ivar] ;  // Prior training set at this lambda
+            if (ilambda > 0) {      // Move it as this training set moved from the prior lambda
+               if (b == 0.0  &&  beta[ivar] == 0.0)
+                  step = 0.0 ;
+               else
+                  step = b + beta[ivar] - path_prior[ivar] ;
+               path_prior[ivar] = b ;
+               if (step * b < 0.0)  // Do not let it cross zero
+                  step = 0.0 ;
+               b = step ;
+               }
+            else
+               path_prior[ivar] = b ;
+            beta[ivar] = b ;
+            }
+         }
+#if STRONG_RULES
+      screening = (ilambda > 0) ;   // Screen using the solution at the prior lambda
+      if (screening) {
+         strong_screen ( alpha , lambda , lambdas[ilambda-1] ) ;
+         memcpy ( warm_beta , beta , nvars * sizeof(double) ) ;
+         }
+#endif
+      core_train ( alpha , lambda , maxits , eps , fast_test , have_path || ilambda ) ;
+#if STRONG_RULES
+      if (screening  &&  hit_maxits  &&  ok) {  // Discarded variables were never checked
+         screening = 0 ;
+         memcpy ( beta , warm_beta , nvars * sizeof(double) ) ;
+         core_train ( alpha , lambda , maxits , eps , fast_test , 1 ) ;
+         }
+#endif
       for (ivar=0 ; ivar<nvars ; ivar++)
          lambda_beta[ilambda*nvars+ivar] = beta[ivar] ;
       if (print_steps) {
@@ -702,6 +1786,9 @@ void CoordinateDescent::lambda_train (
       lambda *= lambda_factor ;
       }
 
+   screening = 0 ;   // Later direct calls to core_train() must see all variables
+   have_path = 1 ;   // Roll_data() keeps these betas as starting points
+
    if (print_steps)
       fclose ( fp_results ) ;
 }
@@ -712,9 +1799,140 @@ void CoordinateDescent::lambda_train (
 
    Cross-validation training routine calls lambda_train() repeatedly to optimize lambda
 
+   The folds are trained concurrently, one per thread.  Each fold gets its
+   training set with get_fold_data(), which subtracts the OOS block from
+   sums over the full database instead of summing the training set.
+   Each fold saves its OOS error sums, and these are combined in fold
+   order, so the result does not depend on the number of threads.
+
 ------------------------------------------------------------------------------------------
 */
 
+typedef struct {
+   int n ;              // Number of cases in full database
+   int nvars ;          // Number of variables (columns in database)
+   int nfolds ;         // Number of folds
+   double *xx ;         // Full database (n rows, nvars columns)
+   double *yy ;         // Predicted variable vector, n long
+   double *ww ;         // Optional weights, n long, or NULL if no differential weighting
+   double *work ;       // Normalized weights of full database, if ww
+   int covar_updates ;  // Does user want (usually faster) covariance update method?
+   int n_lambda ;       // This many lambdas tested by lambda_train()
+   double alpha ;       // User-specified alpha
+   int maxits ;         // Maximum iterations, for safety only
+   double eps ;         // Convergence criterion
+   int fast_test ;      // Base convergence on max beta change vs explained variance?
+   double max_lambda ;  // Starting lambda for all folds
+   CV_FULL *fs ;        // Sums over the full database
+   int *fold_IS ;       // Nfolds; training set of each fold starts at this index
+   int *fold_nIS ;      // Nfolds; and has this many cases
+   double *fold_OOS ;   // Nfolds * n_lambda; OOS error sum of each fold for each lambda
+   double *fold_Ysq ;   // Nfolds; OOS sum of squared normalized Y
+   double *lambdas ;    // Output: lambdas tested by lambda_train(), saved by fold 0
+   volatile LONG next_fold ; // Next fold to be claimed by a thread
+   volatile LONG failed ;    // Set if a fold ran out of memory
+} CV_FOLDS ;
+
+unsigned int __stdcall CoordinateDescent::fold_thread ( void *dp )
+{
+   int ifold, i_OOS, n_OOS, n_nz, icase, ivar, ilambda, k, nvars, n_lambda ;
+   int *nz ;
+   double pred, diff, wt, Ynormalized, *xptr, *z, *coefs, *oos ;
+   CV_FOLDS *folds ;
+   CoordinateDescent *cd ;
+
+   folds = (CV_FOLDS *) dp ;
+   nvars = folds->nvars ;
+   n_lambda = folds->n_lambda ;
+
+   z = (double *) malloc ( (nvars + n_lambda * nvars) * sizeof(double) ) ;
+   nz = (int *) malloc ( nvars * sizeof(int) ) ;
+   if (z == NULL  ||  nz == NULL) {
+      if (z != NULL)
+         free ( z ) ;
+      if (nz != NULL)
+         free ( nz ) ;
+      folds->failed = 1 ;
+      return 0 ;
+      }
+   coefs = z + nvars ;
+
+   for (;;) {
+      ifold = (int) InterlockedIncrement ( &folds->next_fold ) - 1 ;
+      if (ifold >= folds->nfolds  ||  folds->failed)
+         break ;
+
+      // Train the model with this IS set
+
+      cd = new CoordinateDescent ( nvars , folds->fold_nIS[ifold] , (folds->ww != NULL) ,
+                                   folds->covar_updates , n_lambda ) ;
+      if (cd->ok)
+         cd->get_fold_data ( folds->fold_IS[ifold] , folds->n , folds->xx , folds->yy , folds->ww , folds->fs ) ;
+      if (cd->ok)
+         cd->lambda_train ( folds->alpha , folds->maxits , folds->eps , folds->fast_test ,
+                            folds->max_lambda , 0 ) ; // Compute the complete set of betas (all lambdas)
+      if (! cd->ok) {
+         delete cd ;
+         folds->failed = 1 ;
+         break ;
+         }
+
+      if (ifold == 0) {
+         for (ilambda=0 ; ilambda<n_lambda ; ilambda++)
+            folds->lambdas[ilambda] = cd->lambdas[ilambda] ;  // This will be the same for all folds
+         }
+
+      // Compute OOS performance for each lambda.
+      // All lambdas are scored together: each OOS case is standardized once,
+      // and the betas of all lambdas multiply it as a matrix.  Variables whose
+      // beta is zero for every lambda are dropped from the matrix.
+
+      n_nz = 0 ;
+      for (ivar=0 ; ivar<nvars ; ivar++) {
+         for (ilambda=0 ; ilambda<n_lambda ; ilambda++) {
+            if (cd->lambda_beta[ilambda*nvars+ivar] != 0.0)
+               break ;
+            }
+         if (ilambda < n_lambda)
+            nz[n_nz++] = ivar ;
+         }
+
+      for (ilambda=0 ; ilambda<n_lambda ; ilambda++) {
+         for (k=0 ; k<n_nz ; k++)
+            coefs[ilambda*n_nz+k] = cd->lambda_beta[ilambda*nvars+nz[k]] ;
+         }
+
+      oos = folds->fold_OOS + ifold * n_lambda ;
+      for (ilambda=0 ; ilambda<n_lambda ; ilambda++)
+         oos[ilambda] = 0.0 ;
+      folds->fold_Ysq[ifold] = 0.0 ;
+
+      n_OOS = folds->n - folds->fold_nIS[ifold] ;
+      i_OOS = (folds->fold_IS[ifold] + folds->fold_nIS[ifold]) % folds->n ;
+      for (icase=0 ; icase<n_OOS ; icase++) {
+         k = (icase + i_OOS) % folds->n ;
+         xptr = folds->xx + k * nvars ;
+         for (ivar=0 ; ivar<n_nz ; ivar++)
+            z[ivar] = (xptr[nz[ivar]] - cd->Xmeans[nz[ivar]]) / cd->Xscales[nz[ivar]] ;
+         Ynormalized = (folds->yy[k] - cd->Ymean) / cd->Yscale ;
+         wt = (folds->ww != NULL)  ?  folds->work[k] : 1.0 ;
+         folds->fold_Ysq[ifold] += wt * Ynormalized * Ynormalized ;
+         for (ilambda=0 ; ilambda<n_lambda ; ilambda++) {
+            pred = gram_dot ( n_nz , coefs + ilambda * n_nz , z ) ;
+            diff = Ynormalized - pred ;
+            oos[ilambda] += wt * diff * diff ;
+            }
+         }
+
+      delete cd ;
+      }
+
+   free ( z ) ;
+   free ( nz ) ;
+   return 0 ;
+}
+
+
 double cv_train (
    int n ,              // Number of cases in full database
    int nvars ,          // Number of variables (columns in database)
@@ -733,10 +1951,14 @@ double cv_train (
    int fast_test        // Base convergence on max beta change vs explained variance?
    )
 {
-   int i_IS, n_IS, i_OOS, n_OOS, n_done, ifold  ;
-   int icase, ivar, ilambda, ibest, k ;
-   double pred, sum, diff, *coefs, max_lambda, Ynormalized, YsumSquares, best ;
+   int i_IS, n_OOS, n_done, ifold, i, nthreads, nstarted ;
+   int icase, ilambda, ibest ;
+   double max_lambda, YsumSquares, best ;
    CoordinateDescent *cd ;
+   CV_FULL fs ;
+   CV_FOLDS folds ;
+   HANDLE threads[MAX_THREADS] ;
+   SYSTEM_INFO sysinfo ;
 
    if (n_lambda < 2)
       return 0.0 ;
@@ -762,65 +1984,102 @@ double cv_train (
    fclose ( fp_results ) ;
 #endif
 
+/*
+   Allocate memory and set up the folds
+*/
+
+   folds.fold_IS = (int *) malloc ( 2 * nfolds * sizeof(int) ) ;
+   folds.fold_OOS = (double *) malloc ( nfolds * (n_lambda + 1) * sizeof(double) ) ;
+   if (folds.fold_IS == NULL  ||  folds.fold_OOS == NULL  ||  ! cv_full_init ( &fs , n , nvars , xx , yy , ww )) {
+      if (folds.fold_IS != NULL)
+         free ( folds.fold_IS ) ;
+      if (folds.fold_OOS != NULL)
+         free ( folds.fold_OOS ) ;
+      return 0.0 ;
+      }
+   folds.fold_nIS = folds.fold_IS + nfolds ;
+   folds.fold_Ysq = folds.fold_OOS + nfolds * n_lambda ;
+
+   folds.n = n ;
+   folds.nvars = nvars ;
+   folds.nfolds = nfolds ;
+   folds.xx = xx ;
+   folds.yy = yy ;
+   folds.ww = ww ;
+   folds.work = work ;
+   folds.covar_updates = covar_updates ;
+   folds.n_lambda = n_lambda ;
+   folds.alpha = alpha ;
+   folds.maxits = maxits ;
+   folds.eps = eps ;
+   folds.fast_test = fast_test ;
+   folds.max_lambda = max_lambda ;
+   folds.fs = &fs ;
+   folds.lambdas = lambdas ;
+   folds.next_fold = 0 ;
+   folds.failed = 0 ;
+
    i_IS = 0 ;        // Training data starts at this index in complete database
    n_done = 0 ;      // Number of cases treated as OOS so far
 
-   for (ilambda=0 ; ilambda<n_lambda ; ilambda++)
-      lambda_OOS[ilambda] = 0.0 ;  // Will cumulate across folds here
-
-   YsumSquares = 0.0 ;    // Will cumulate to compute explained fraction
+   for (ifold=0 ; ifold<nfolds ; ifold++) {
+      n_OOS = (n - n_done) / (nfolds - ifold) ;  // Number OOS  (test set)
+      folds.fold_IS[ifold] = i_IS ;
+      folds.fold_nIS[ifold] = n - n_OOS ;        // Number IS (training set)
+      n_done += n_OOS ;                          // Cumulate OOS cases just processed
+      i_IS = (i_IS + n_OOS) % n ;                // Next IS starts at this index
+      }
 
 /*
-   Process the folds
+   Process the folds.  This thread is one of the threads.
 */
 
-   for (ifold=0 ; ifold<nfolds ; ifold++) {
+   GetSystemInfo ( &sysinfo ) ;
+   nthreads = (int) sysinfo.dwNumberOfProcessors ;
+   if (nthreads > nfolds)
+      nthreads = nfolds ;
+   if (nthreads > MAX_THREADS)
+      nthreads = MAX_THREADS ;
+
+   nstarted = 0 ;
+   for (i=1 ; i<nthreads ; i++) {
+      threads[nstarted] = (HANDLE) _beginthreadex ( NULL , 0 , CoordinateDescent::fold_thread , &folds , 0 , NULL ) ;
+      if (threads[nstarted] != NULL)
+         ++nstarted ;
+      }
 
-      n_OOS = (n - n_done) / (nfolds - ifold) ;  // Number OOS  (test set)
-      n_IS = n - n_OOS ;                         // Number IS (training set)
-      i_OOS = (i_IS + n_IS) % n ;                // OOS starts at this index
+   CoordinateDescent::fold_thread ( &folds ) ;
 
-      // Train the model with this IS set
+   if (nstarted) {
+      WaitForMultipleObjects ( nstarted , threads , TRUE , INFINITE ) ;
+      for (i=0 ; i<nstarted ; i++)
+         CloseHandle ( threads[i] ) ;
+      }
 
-      cd = new CoordinateDescent ( nvars , n_IS , (ww != NULL) , covar_updates , n_lambda ) ;
-      cd->get_data ( i_IS , n , xx , yy , ww ) ;                  // Fetch the training set for this fold
-      cd->lambda_train ( alpha , maxits , eps , fast_test , max_lambda , 0 ) ; // Compute the complete set of betas (all lambdas)
+   cv_full_free ( &fs ) ;
 
-      // Compute OOS performance for each lambda and sum across folds.
-      // Normalization of X and Y is repeated, when it could be done once and saved.
-      // But the relative cost is minimal, and it is simpler doing it this way.
+   if (folds.failed) {
+      free ( folds.fold_IS ) ;
+      free ( folds.fold_OOS ) ;
+      return 0.0 ;
+      }
 
-      for (ilambda=0 ; ilambda<n_lambda ; ilambda++) {
-         lambdas[ilambda] = cd->lambdas[ilambda] ;  // This will be the same for all folds
-         coefs = cd->lambda_beta + ilambda * nvars ;
-         sum = 0.0 ;
-         for (icase=0 ; icase<n_OOS ; icase++) {
-            k = (icase + i_OOS) % n ;
-            pred = 0.0 ;
-            for (ivar=0 ; ivar<nvars ; ivar++)
-               pred += coefs[ivar] * (xx[k*nvars+ivar] - cd->Xmeans[ivar]) / cd->Xscales[ivar] ;
-            Ynormalized = (yy[k] - cd->Ymean) / cd->Yscale ;
-            diff = Ynormalized - pred ;
-            if (ww != NULL) {
-               if (ilambda == 0)
-                  YsumSquares += work[k] * Ynormalized * Ynormalized ;
-               sum += work[k] * diff * diff ;
-               }
-            else {
-               if (ilambda == 0)
-                  YsumSquares += Ynormalized * Ynormalized ;
-               sum += diff * diff ;
-               }
-            }
-         lambda_OOS[ilambda] += sum ;  // Cumulate for this fold
-         }  // For ilambda
+/*
+   Sum the OOS results across folds, in fold order
+*/
 
-      delete cd ;
+   for (ilambda=0 ; ilambda<n_lambda ; ilambda++)
+      lambda_OOS[ilambda] = 0.0 ;
 
-      n_done += n_OOS ;                           // Cumulate OOS cases just processed
-      i_IS = (i_IS + n_OOS) % n ;                 // Next IS starts at this index
+   YsumSquares = 0.0 ;
+   for (ifold=0 ; ifold<nfolds ; ifold++) {
+      YsumSquares += folds.fold_Ysq[ifold] ;
+      for (ilambda=0 ; ilambda<n_lambda ; ilambda++)
+         lambda_OOS[ilambda] += folds.fold_OOS[ifold*n_lambda+ilambda] ;
+      }
 
-      }  // For ifold
+   free ( folds.fold_IS ) ;
+   free ( folds.fold_OOS ) ;
 
 /*
    Compute OOS explained variance for each lambda, and keep track of the best
@@ -11,6 +11,8 @@
 #include <stdlib.h>
 #include <conio.h>
 #include <assert.h>
+#include "MWC256.H"
+#include "MC_STUDY.H"
 
 
 /*
@@ -72,55 +74,6 @@ void qsortd ( int first , int last , double *data )
 }
 
 
-/*
---------------------------------------------------------------------------------
-
-   This is a random int generator suggested by Marsaglia in his DIEHARD suite.
-   It provides a great combination of speed and quality.
-
-   We also have unifrand(), a random 0-1 generator.
-
---------------------------------------------------------------------------------
-*/
-
-static unsigned int Q[256], carry=362436 ;
-static int MWC256_initialized = 0 ;
-static int MWC256_seed = 123456789 ;
-
-void RAND32M_seed ( int iseed ) { // Optionally set seed
-   MWC256_seed = iseed ;
-   MWC256_initialized = 0 ;
-   }
-
-unsigned int RAND32M ()
-{
-   unsigned _int64 t ;
-   unsigned _int64 a=809430660 ;
-   static unsigned char i=255 ;
-
-   if (! MWC256_initialized) {
-      unsigned int k,j=MWC256_seed ;
-      MWC256_initialized = 1 ;
-      for (k=0 ; k<256 ; k++) {
-         j = 69069 * j + 12345 ; // This overflows, doing an automatic mod 2^32
-         Q[k] = j ;
-         }
-      }
-
-   t = a * Q[++i] + carry ;  // This is the 64-bit op, forced by a being 64-bit
-   carry = (unsigned int) (t >> 32) ;
-   Q[i] = (unsigned int) (t & 0xFFFFFFFF) ;
-   return Q[i] ;
-}
-
-
-double unifrand ()
-{
-   double mult = 1.0 / 0xFFFFFFFF ;
-   return mult * RAND32M() ;
-}
-
-
 /*
 --------------------------------------------------------------------------------
 
@@ -198,6 +151,146 @@ void find_beta (
 }
 
 
+/*
+--------------------------------------------------------------------------------
+
+   One replication of the study, and the merging of replications
+   These are called by mc_run() in MC_STUDY.CPP.
+
+--------------------------------------------------------------------------------
+*/
+
+typedef struct {
+   int nprices ;     // Total number of prices (bars in history)
+   int lookback ;    // Historical window length for indicator
+   int lookahead ;   // Bars into future for target
+   int ntrain ;      // Number of cases in training set
+   int ntest ;       // Number of cases in test set
+   int omit ;        // Omit this many cases from end of training window
+   int extra ;       // Extra (beyond ntest) bars jumped for next fold
+   double *save_t ;  // Output: t-score of each replication
+} OVERLAP_CONTEXT ;
+
+typedef struct {
+   int p1_count ;    // Counts reps with right tail p <= 0.1
+   int n_OOS ;       // Last replication, for printing
+   double oos_mean, oos_ss, t, rtail ;
+} OVERLAP_ACC ;
+
+static void overlap_rep ( int irep , MWC256 *rng , void *context , void *work , void *acc )
+{
+   int i, ncols, ncases, nprices, lookback, lookahead, ntrain, ntest, omit, extra ;
+   int ifold, nt, istart, itest, n_OOS ;
+   double *x, *data, *trn_ptr, *test_ptr, beta, constant, pred, *oos ;
+   double oos_mean, oos_ss, t, rtail ;
+   OVERLAP_CONTEXT *con ;
+   OVERLAP_ACC *a ;
+
+   con = (OVERLAP_CONTEXT *) context ;
+   a = (OVERLAP_ACC *) acc ;
+
+   nprices = con->nprices ;
+   lookback = con->lookback ;
+   lookahead = con->lookahead ;
+   ntrain = con->ntrain ;
+   ntest = con->ntest ;
+   omit = con->omit ;
+   extra = con->extra ;
+
+   ncols = 2 ;   // Hard-programmed into this demonstration (1 predictor + target)
+   x = (double *) work ;
+   data = x + nprices ;         // More than we need, but simple
+   oos = data + ncols * nprices ;
+
+/*
+   Generate the log prices as a random walk,
+   and then compute the dataset, which is a 2-column matrix.
+   The first column is the indicator and the second column is the corresponding target.
+*/
+
+   x[0] = 0.0 ;
+   for (i=1 ; i<nprices ; i++)
+      x[i] = x[i-1] + rng->unifrand() + rng->unifrand() - rng->unifrand() - rng->unifrand() ;
+
+   ncases = 0 ;
+   for (i=lookback-1 ; i<nprices-lookahead ; i++) {
+      ind_targ ( lookback , lookahead , x+i , data+ncols*ncases , data+ncols*ncases+1 ) ;
+      ++ncases ;
+      }
+
+/*
+   Compute the walkforward OOS values
+*/
+
+   trn_ptr = data ;            // Point to training set
+   istart = ntrain ;           // First OOS case
+   n_OOS = 0 ;                 // Counts OOS cases
+
+   for (ifold=0 ;; ifold++) {
+      test_ptr = trn_ptr + ncols * ntrain ;    // Test set starts right after training set
+      if (test_ptr >= data + ncols * ncases )  // No test cases left?
+         break ;
+      find_beta ( ntrain - omit , trn_ptr , &beta , &constant ) ;
+      nt = ntest ;
+      if (nt > ncases - istart)                  // Last fold may be incomplete
+         nt = ncases - istart ;
+      for (itest=0 ; itest<nt ; itest++) {       // For every case in the test set
+         assert ( test_ptr + 1 < data + ncols * ncases ) ; // Verify testing valid data
+         pred = beta * *test_ptr++ + constant ;  // test_ptr points to target after this line of code
+         if (pred > 0.0)
+            oos[n_OOS++] = *test_ptr ;
+         else
+            oos[n_OOS++] = - *test_ptr ;
+         ++test_ptr ;    // Advance to indicator for next test case
+         }
+      istart += nt + extra ;          // First OOS case for next fold
+      trn_ptr += ncols * (nt + extra) ;   // Advance to next fold
+      }
+
+/*
+   Analyze results
+*/
+
+   oos_mean = oos_ss = 0.0 ;
+   for (i=0 ; i<n_OOS ; i++) {
+      oos_mean += oos[i] ;
+      oos_ss += oos[i] * oos[i] ;
+      }
+
+   oos_mean /= n_OOS ;
+   oos_ss /= n_OOS ;                // Formula in next line is usually dangerous
+   oos_ss -= oos_mean * oos_mean ;  // But it is fine here because oos_mean is not large
+
+   if (oos_ss < 1.e-20)
+      oos_ss = 1.e-20 ;
+
+   t = sqrt((double) n_OOS) * oos_mean / sqrt ( oos_ss ) ;  // Compute t-score
+   rtail = 1.0 - normal_cdf ( t ) ;  // Normal CDF is close enough when n_OOS is not small
+   con->save_t[irep] = t ;
+
+   if (rtail <= 0.1)
+      ++a->p1_count ;    // In correct walkforward, this should happen about 1 out of 10 times
+
+   a->n_OOS = n_OOS ;
+   a->oos_mean = oos_mean ;
+   a->oos_ss = oos_ss ;
+   a->t = t ;
+   a->rtail = rtail ;
+}
+
+static void overlap_merge ( void *total , void *acc , int first_rep , int nreps , void *context )
+{
+   OVERLAP_ACC *t, *a ;
+
+   t = (OVERLAP_ACC *) total ;
+   a = (OVERLAP_ACC *) acc ;
+   t->p1_count += a->p1_count ;
+   t->n_OOS = a->n_OOS ;   // The same for every replication
+   if (nreps == 1)
+      printf ( "\nMean = %.4lf  StdDev = %.4lf  t = %.4lf  p = %.4lf", a->oos_mean, sqrt(a->oos_ss), a->t, a->rtail ) ;
+}
+
+
 /*
 --------------------------------------------------------------------------------
 
@@ -211,18 +304,32 @@ int main (
    char *argv[]  // Arguments (prog name is argv[0])
    )
 {
-   int i, ncols, ncases, nprices, lookback, lookahead, ntrain, ntest, omit, extra ;
-   int ifold, nt, istart, itest, n_OOS, irep, nreps, p1_count ;
-   double *x, *data, *trn_ptr, *test_ptr, beta, constant, pred, *oos ;
-   double oos_mean, oos_ss, t, *save_t, rtail ;
+   int nprices, lookback, lookahead, ntrain, ntest, omit, extra ;
+   int n_OOS, nreps, p1_count, nthreads ;
+   double *save_t ;
+   OVERLAP_CONTEXT context ;
+   OVERLAP_ACC total ;
+   MC_STUDY study ;
 
 /*
    Process command line parameters
 */
 
 #if 1
+   nthreads = MC_SERIAL ;   // The original serial algorithm
+   if (argc == 11  &&  ! strcmp ( argv[1] , "--threads" )) {
+      nthreads = atoi ( argv[2] ) ;   // mc_run() takes 0 as all processors
+      if (nthreads < 0)
+         nthreads = 0 ;
+      argc -= 2 ;
+      argv += 2 ;
+      }
+
    if (argc != 9) {
-      printf ( "\nUsage: Overlap  nprices  lookback  lookahead  ntrain  ntest  omit  extra  nreps" ) ;
+      printf ( "\nUsage: Overlap  [--threads N]  nprices  lookback  lookahead  ntrain  ntest  omit  extra  nreps" ) ;
+      printf ( "\n  --threads N - Run replications on N threads (0 for all processors)" ) ;
+      printf ( "\n                Each replication has its own random stream, so results" ) ;
+      printf ( "\n                are the same for any N but differ from the serial run" ) ;
       printf ( "\n  nprices - Total number of prices (bars in history)" ) ;
       printf ( "\n  lookback - historical window length for indicator" ) ;
       printf ( "\n  lookahead - Bars into future for target" ) ;
@@ -243,6 +350,7 @@ int main (
    extra = atoi ( argv[7] ) ;
    nreps = atoi ( argv[8] ) ;
 #else
+   nthreads = MC_SERIAL ;
    nprices = 100000 ;
    lookback = 1000 ;
    lookahead = 1 ;
@@ -259,7 +367,10 @@ int main (
        ntrain < 2  ||  ntest < 1  ||  omit < 0  ||  extra < 0) {
       if (nprices < lookback + lookahead + ntrain + ntest + 10)
          printf ( "\nNprices must be at least lookback + lookahead + ntrain + ntest + 10" ) ;
-      printf ( "\nUsage: Overlap  nprices  lookback  lookahead  ntrain  ntest  omit  extra  nreps" ) ;
+      printf ( "\nUsage: Overlap  [--threads N]  nprices  lookback  lookahead  ntrain  ntest  omit  extra  nreps" ) ;
+      printf ( "\n  --threads N - Run replications on N threads (0 for all processors)" ) ;
+      printf ( "\n                Each replication has its own random stream, so results" ) ;
+      printf ( "\n                are the same for any N but differ from the serial run" ) ;
       printf ( "\n  nprices - Total number of prices (bars in history)" ) ;
       printf ( "\n  lookback - historical window length for indicator" ) ;
       printf ( "\n  lookahead - Bars into future for target" ) ;
@@ -278,101 +389,46 @@ int main (
    Initialize
 */
 
-   ncols = 2 ;   // Hard-programmed into this demonstration (1 predictor + target)
-   x = (double *) malloc ( nprices * sizeof(double) ) ;
-   data = (double *) malloc ( ncols * nprices * sizeof(double) ) ;  // More than we need, but simple
-   oos = (double *) malloc ( nprices * sizeof(double) ) ;       // Ditto
    save_t = (double *) malloc ( nreps * sizeof(double) ) ;
 
-   p1_count = 0 ;  // Will count reps with right tail p <= 0.1
-
 /*
    This simply replicates the test a few times in one run to get median t and p<=0.1 count.
-   It is not a MCPT.
-*/
-
-   for (irep=0 ; irep<nreps ; irep++) {
-
-/*
-   Generate the log prices as a random walk,
-   and then compute the dataset, which is a 2-column matrix.
-   The first column is the indicator and the second column is the corresponding target.
+   It is not a MCPT.  The replications are done by mc_run().
 */
 
-      x[0] = 0.0 ;
-      for (i=1 ; i<nprices ; i++)
-         x[i] = x[i-1] + unifrand() + unifrand() - unifrand() - unifrand() ;
-
-      ncases = 0 ;
-      for (i=lookback-1 ; i<nprices-lookahead ; i++) {
-         ind_targ ( lookback , lookahead , x+i , data+ncols*ncases , data+ncols*ncases+1 ) ;
-         ++ncases ;
-         }
-
-/*
-   Compute the walkforward OOS values
-*/
-
-      trn_ptr = data ;            // Point to training set
-      istart = ntrain ;           // First OOS case
-      n_OOS = 0 ;                 // Counts OOS cases
-
-      for (ifold=0 ;; ifold++) {
-         test_ptr = trn_ptr + ncols * ntrain ;    // Test set starts right after training set
-         if (test_ptr >= data + ncols * ncases )  // No test cases left?
-            break ;
-         find_beta ( ntrain - omit , trn_ptr , &beta , &constant ) ;
-         nt = ntest ;
-         if (nt > ncases - istart)                  // Last fold may be incomplete
-            nt = ncases - istart ;
-         for (itest=0 ; itest<nt ; itest++) {       // For every case in the test set
-            assert ( test_ptr + 1 < data + ncols * ncases ) ; // Verify testing valid data
-            pred = beta * *test_ptr++ + constant ;  // test_ptr points to target after this line of code
-            if (pred > 0.0)
-               oos[n_OOS++] = *test_ptr ;
-            else
-               oos[n_OOS++] = - *test_ptr ;
-            ++test_ptr ;    // Advance to indicator for next test case
-            }
-         istart += nt + extra ;          // First OOS case for next fold
-         trn_ptr += ncols * (nt + extra) ;   // Advance to next fold
-         }
-
-/*
-   Analyze results
-*/
-
-      oos_mean = oos_ss = 0.0 ;
-      for (i=0 ; i<n_OOS ; i++) {
-         oos_mean += oos[i] ;
-         oos_ss += oos[i] * oos[i] ;
-         }
-
-      oos_mean /= n_OOS ;
-      oos_ss /= n_OOS ;                // Formula in next line is usually dangerous
-      oos_ss -= oos_mean * oos_mean ;  // But it is fine here because oos_mean is not large
-
-      if (oos_ss < 1.e-20)
-         oos_ss = 1.e-20 ;
-
-      t = sqrt((double) n_OOS) * oos_mean / sqrt ( oos_ss ) ;  // Compute t-score
-      rtail = 1.0 - normal_cdf ( t ) ;  // Normal CDF is close enough when n_OOS is not small
-      printf ( "\nMean = %.4lf  StdDev = %.4lf  t = %.4lf  p = %.4lf", oos_mean, sqrt(oos_ss), t, rtail ) ;      
-      save_t[irep] = t ;
-
-      if (rtail <= 0.1)
-         ++p1_count ;    // In correct walkforward, this should happen about 1 out of 10 times
+   context.nprices = nprices ;
+   context.lookback = lookback ;
+   context.lookahead = lookahead ;
+   context.ntrain = ntrain ;
+   context.ntest = ntest ;
+   context.omit = omit ;
+   context.extra = extra ;
+   context.save_t = save_t ;
+
+   memset ( &study , 0 , sizeof(study) ) ;
+   study.nreps = nreps ;
+   study.nthreads = nthreads ;
+   study.seed = MWC256_DEFAULT_SEED ;
+   study.block = 1 ;            // Print every replication
+   study.work_bytes = 4 * nprices * sizeof(double) ; // x, data, oos
+   study.acc_bytes = sizeof(OVERLAP_ACC) ;
+   study.context = &context ;
+   study.rep = overlap_rep ;
+   study.merge = overlap_merge ;
+
+   if (save_t == NULL  ||  mc_run ( &study , &total ) < 0) {
+      printf ( "\n\nInsufficient memory" ) ;
+      exit ( 1 ) ;
+      }
 
-      }  // For all replications
+   n_OOS = total.n_OOS ;
+   p1_count = total.p1_count ;
 
    qsortd ( 0 , nreps-1 , save_t ) ;
    printf ( "\nn OOS = %d  Median t = %.4lf  Fraction with p<= 0.1 = %.3lf",
             n_OOS, save_t[nreps/2], (double) p1_count / nreps ) ;
    _getch () ;  // Wait for user to press a key
 
-   free ( x ) ;
-   free ( data ) ;
-   free ( oos ) ;
    free ( save_t ) ;
 
    return 0 ;
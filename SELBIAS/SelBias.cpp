@@ -10,55 +10,8 @@
 #include <float.h>
 #include <stdlib.h>
 #include <conio.h>
-
-
-/*
---------------------------------------------------------------------------------
-
-   This is a random int generator suggested by Marsaglia in his DIEHARD suite.
-   It provides a great combination of speed and quality.
-
-   We also have unifrand(), a random 0-1 generator based on it.
-
---------------------------------------------------------------------------------
-*/
-
-static unsigned int Q[256], carry=362436 ;
-static int MWC256_initialized = 0 ;
-static int MWC256_seed = 123456789 ;
-
-void RAND32M_seed ( int iseed ) { // Optionally set seed
-   MWC256_seed = iseed ;
-   MWC256_initialized = 0 ;
-   }
-
-unsigned int RAND32M ()
-{
-   unsigned _int64 t ;
-   unsigned _int64 a=809430660 ;
-   static unsigned char i=255 ;
-
-   if (! MWC256_initialized) {
-      unsigned int k,j=MWC256_seed ;
-      MWC256_initialized = 1 ;
-      for (k=0 ; k<256 ; k++) {
-         j = 69069 * j + 12345 ; // This overflows, doing an automatic mod 2^32
-         Q[k] = j ;
-         }
-      }
-
-   t = a * Q[++i] + carry ;  // This is the 64-bit op, forced by a being 64-bit
-   carry = (unsigned int) (t >> 32) ;
-   Q[i] = (unsigned int) (t & 0xFFFFFFFF) ;
-   return Q[i] ;
-}
-
-
-double unifrand ()
-{
-   static double mult = 1.0 / 0xFFFFFFFF ;
-   return mult * RAND32M() ;
-}
+#include "MWC256.H"
+#include "MC_STUDY.H"
 
 
 /*
@@ -233,6 +186,143 @@ double test_system (
 }
 
 
+/*
+--------------------------------------------------------------------------------
+
+   One replication of the study, and the merging of replications
+   These are called by mc_run() in MC_STUDY.CPP.
+
+--------------------------------------------------------------------------------
+*/
+
+typedef struct {
+   int which ;       // 0=mean return; 1=profit factor; 2=Sharpe ratio
+   int ncases ;      // Number of training and test cases
+   double trend ;    // Amount of trending
+} SEL_CONTEXT ;
+
+typedef struct {
+   double L_IS_sum, L_OOS_sum, S_IS_sum, S_OOS_sum ; // For training bias
+   double OOS_sum, Bias_sum, Bias_SS ;               // For selection bias
+   int L_short_lookback, L_long_lookback, S_short_lookback, S_long_lookback ; // Last replication, for printing
+   double L_IS_perf, S_IS_perf, L_OOS_perf, S_OOS_perf, OOS_perf, Bias ;
+} SEL_ACC ;
+
+static void generate (   // Generate a set of log prices
+   MWC256 *rng ,
+   int ncases ,
+   double save_trend ,
+   double *x
+   )
+{
+   int i ;
+   double trend ;
+
+   trend = save_trend ;
+   x[0] = 0.0 ;
+   for (i=1 ; i<ncases ; i++) {
+      if ((i+1) % 50 == 0)   // Reverse the trend every 50 days
+         trend = -trend ;
+      x[i] = x[i-1] + trend + rng->unifrand() + rng->unifrand() - rng->unifrand() - rng->unifrand() ;
+      }
+}
+
+static void sel_rep ( int irep , MWC256 *rng , void *context , void *work , void *acc )
+{
+   int ncases, L_short_lookback, L_long_lookback, S_short_lookback, S_long_lookback ;
+   double *x, L_IS_perf, S_IS_perf, L_OOS_perf, S_OOS_perf, OOS_perf, Bias ;
+   SEL_CONTEXT *con ;
+   SEL_ACC *a ;
+
+   con = (SEL_CONTEXT *) context ;
+   a = (SEL_ACC *) acc ;
+   x = (double *) work ;
+   ncases = con->ncases ;
+
+   // Generate the in-sample set (log prices)
+   generate ( rng , ncases , con->trend , x ) ;
+
+   // Compute optimal parameters, evaluate return with same dataset
+   // The first pair of lines below is for the long-only model, second pair short-only
+
+   opt_params ( con->which , 1 , ncases , x , &L_short_lookback , &L_long_lookback ) ;
+   L_IS_perf = test_system ( 1 , ncases , x , L_short_lookback , L_long_lookback ) ;
+
+   opt_params ( con->which , 0 , ncases , x , &S_short_lookback , &S_long_lookback ) ;
+   S_IS_perf = test_system ( 0 , ncases , x , S_short_lookback , S_long_lookback ) ;
+
+   // Generate the first out_of-sample set (log prices)
+   // This will give us the performance results on which our choice of model is based
+
+   generate ( rng , ncases , con->trend , x ) ;
+
+   // Test this first OOS set and cumulate means across replications
+   // We will compare L_OOS_perf with S_OOS_perf to choose the best model for the final test
+
+   L_OOS_perf = test_system ( 1 , ncases , x , L_short_lookback , L_long_lookback ) ;
+   S_OOS_perf = test_system ( 0 , ncases , x , S_short_lookback , S_long_lookback ) ;
+
+   // Generate the second out_of-sample set (log prices)
+   // This is the 'ultimate' OOS set, which has selection bias removed
+
+   generate ( rng , ncases , con->trend , x ) ;
+
+   // Test this second OOS set
+   // We choose either the long or the short model, depending on which
+   // did better on the first OOS set
+
+   if (L_OOS_perf > S_OOS_perf) {
+      OOS_perf = test_system ( 1 , ncases , x , L_short_lookback , L_long_lookback ) ;
+      Bias = L_OOS_perf - OOS_perf ;  // This is the selection bias for this replication
+      }
+   else {
+      OOS_perf = test_system ( 0 , ncases , x , S_short_lookback , S_long_lookback ) ;
+      Bias = S_OOS_perf - OOS_perf ;  // This is the selection bias for this replication
+      }
+
+   a->L_IS_sum += L_IS_perf ;
+   a->L_OOS_sum += L_OOS_perf ;
+   a->S_IS_sum += S_IS_perf ;
+   a->S_OOS_sum += S_OOS_perf ;
+   a->Bias_sum += Bias ;
+   a->Bias_SS += Bias * Bias ;  // We'll need this for t-test
+   a->OOS_sum += OOS_perf ;     // This is the final OOS performance, with both training and selection bias removed
+
+   a->L_short_lookback = L_short_lookback ;
+   a->L_long_lookback = L_long_lookback ;
+   a->S_short_lookback = S_short_lookback ;
+   a->S_long_lookback = S_long_lookback ;
+   a->L_IS_perf = L_IS_perf ;
+   a->S_IS_perf = S_IS_perf ;
+   a->L_OOS_perf = L_OOS_perf ;
+   a->S_OOS_perf = S_OOS_perf ;
+   a->OOS_perf = OOS_perf ;
+   a->Bias = Bias ;
+}
+
+static void sel_merge ( void *total , void *acc , int first_rep , int nreps , void *context )
+{
+   SEL_ACC *t, *a ;
+
+   t = (SEL_ACC *) total ;
+   a = (SEL_ACC *) acc ;
+   t->L_IS_sum += a->L_IS_sum ;
+   t->L_OOS_sum += a->L_OOS_sum ;
+   t->S_IS_sum += a->S_IS_sum ;
+   t->S_OOS_sum += a->S_OOS_sum ;
+   t->Bias_sum += a->Bias_sum ;
+   t->Bias_SS += a->Bias_SS ;
+   t->OOS_sum += a->OOS_sum ;
+
+   if (nreps == 1) {
+      printf ( "\n%3d: %3d %3d %3d %3d  %8.4lf %8.4lf (%8.4lf)  %8.4lf %8.4lf (%8.4lf)",
+               first_rep, a->L_short_lookback, a->L_long_lookback, a->S_short_lookback, a->S_long_lookback,
+               a->L_IS_perf, a->L_OOS_perf, a->L_IS_perf - a->L_OOS_perf, a->S_IS_perf, a->S_OOS_perf, a->S_IS_perf - a->S_OOS_perf ) ;
+      printf ( "\n     OOS_perf=%8.4lf  Bias=%8.4lf", a->OOS_perf, a->Bias ) ;
+      }
+}
+
+
 /*
 --------------------------------------------------------------------------------
 
@@ -246,17 +336,31 @@ int main (
    char *argv[]  // Arguments (prog name is argv[0])
    )
 {
-   int i, which, ncases, irep, nreps, L_short_lookback, L_long_lookback, S_short_lookback, S_long_lookback ;
-   double save_trend, trend, *x, L_IS_perf, S_IS_perf, L_OOS_perf, S_OOS_perf, OOS_mean ;
-   double Bias, Bias_mean, OOS_perf, L_IS_mean, S_IS_mean, L_OOS_mean, S_OOS_mean, Bias_SS, t ;
+   int which, ncases, nreps, nthreads ;
+   double save_trend, OOS_mean, Bias_mean, L_IS_mean, S_IS_mean, L_OOS_mean, S_OOS_mean, Bias_SS, t ;
+   SEL_CONTEXT context ;
+   SEL_ACC total ;
+   MC_STUDY study ;
 
 /*
    Process command line parameters
 */
 
 #if 1
+   nthreads = MC_SERIAL ;   // The original serial algorithm
+   if (argc == 7  &&  ! strcmp ( argv[1] , "--threads" )) {
+      nthreads = atoi ( argv[2] ) ;   // mc_run() takes 0 as all processors
+      if (nthreads < 0)
+         nthreads = 0 ;
+      argc -= 2 ;
+      argv += 2 ;
+      }
+
    if (argc != 5) {
-      printf ( "\nUsage: SelBias  which  ncases trend  nreps" ) ;
+      printf ( "\nUsage: SelBias  [--threads N]  which  ncases trend  nreps" ) ;
+      printf ( "\n  --threads N - Run replications on N threads (0 for all processors)" ) ;
+      printf ( "\n                Each replication has its own random stream, so results" ) ;
+      printf ( "\n                are the same for any N but differ from the serial run" ) ;
       printf ( "\n  which - 0=mean return  1=profit factor  2=Sharpe ratio" ) ;
       printf ( "\n  ncases - number of training and test cases" ) ;
       printf ( "\n  trend - Amount of trending, 0 for flat system" ) ;
@@ -269,6 +373,7 @@ int main (
    save_trend = atof ( argv[3] ) ;
    nreps = atoi ( argv[4] ) ;
 #else
+   nthreads = MC_SERIAL ;
    which = 1 ;
    ncases = 1000 ;
    save_trend = 0.2 ;
@@ -276,7 +381,10 @@ int main (
 #endif
 
    if (ncases < 2  ||  which < 0  ||  which > 2  ||  nreps < 1) {
-      printf ( "\nUsage: SelBias  which  ncases trend  nreps" ) ;
+      printf ( "\nUsage: SelBias  [--threads N]  which  ncases trend  nreps" ) ;
+      printf ( "\n  --threads N - Run replications on N threads (0 for all processors)" ) ;
+      printf ( "\n                Each replication has its own random stream, so results" ) ;
+      printf ( "\n                are the same for any N but differ from the serial run" ) ;
       printf ( "\n  which - 0=mean return  1=profit factor  2=Sharpe ratio" ) ;
       printf ( "\n  ncases - number of training and test cases" ) ;
       printf ( "\n  trend - Amount of trending, 0 for flat system" ) ;
@@ -287,105 +395,42 @@ int main (
    printf ( "\n\nwhich=%d ncases=%d trend=%.3lf nreps=%d", which, ncases, save_trend, nreps ) ;
 
 /*
-   Initialize
+   Main replication loop, done by mc_run()
 */
 
-   x = (double *) malloc ( ncases * sizeof(double) ) ;
-
-/*
-   Main replication loop
-*/
-
-   L_IS_mean = S_IS_mean = L_OOS_mean = S_OOS_mean = OOS_mean = Bias_mean = Bias_SS = 0.0 ;
-
-   for (irep=0 ; irep<nreps ; irep++) {  // Do many trials to get a stable average
-
-      // Generate the in-sample set (log prices)
-      trend = save_trend ;
-      x[0] = 0.0 ;
-      for (i=1 ; i<ncases ; i++) {
-         if ((i+1) % 50 == 0)   // Reverse the trend every 50 days
-            trend = -trend ;
-         x[i] = x[i-1] + trend + unifrand() + unifrand() - unifrand() - unifrand() ;
-         }
-
-      // Compute optimal parameters, evaluate return with same dataset
-      // The first pair of lines below is for the long-only model, second pair short-only
-
-      opt_params ( which , 1 , ncases , x , &L_short_lookback , &L_long_lookback ) ;
-      L_IS_perf = test_system ( 1 , ncases , x , L_short_lookback , L_long_lookback ) ;
-
-      opt_params ( which , 0 , ncases , x , &S_short_lookback , &S_long_lookback ) ;
-      S_IS_perf = test_system ( 0 , ncases , x , S_short_lookback , S_long_lookback ) ;
-
-      // Generate the first out_of-sample set (log prices)
-      // This will give us the performance results on which our choice of model is based
-
-      trend = save_trend ;
-      x[0] = 0.0 ;
-      for (i=1 ; i<ncases ; i++) {
-         if ((i+1) % 50 == 0)
-            trend = -trend ;
-         x[i] = x[i-1] + trend + unifrand() + unifrand() - unifrand() - unifrand() ;
-         }
-
-      // Test this first OOS set and cumulate means across replications
-      // We will compare L_OOS_perf with S_OOS_perf to choose the best model for the final test
-
-      L_OOS_perf = test_system ( 1 , ncases , x , L_short_lookback , L_long_lookback ) ;
-      S_OOS_perf = test_system ( 0 , ncases , x , S_short_lookback , S_long_lookback ) ;
-
-      L_IS_mean += L_IS_perf ;
-      L_OOS_mean += L_OOS_perf ;
-      S_IS_mean += S_IS_perf ;
-      S_OOS_mean += S_OOS_perf ;
-      printf ( "\n%3d: %3d %3d %3d %3d  %8.4lf %8.4lf (%8.4lf)  %8.4lf %8.4lf (%8.4lf)",
-               irep, L_short_lookback, L_long_lookback, S_short_lookback, S_long_lookback,
-               L_IS_perf, L_OOS_perf, L_IS_perf - L_OOS_perf, S_IS_perf, S_OOS_perf, S_IS_perf - S_OOS_perf ) ;
-
-      // Generate the second out_of-sample set (log prices)
-      // This is the 'ultimate' OOS set, which has selection bias removed
-
-      trend = save_trend ;
-      x[0] = 0.0 ;
-      for (i=1 ; i<ncases ; i++) {
-         if ((i+1) % 50 == 0)
-            trend = -trend ;
-         x[i] = x[i-1] + trend + unifrand() + unifrand() - unifrand() - unifrand() ;
-         }
-
-      // Test this second OOS set and cumulate means across replications
-      // We choose either the long or the short model, depending on which
-      // did better on the first OOS set
-
-      if (L_OOS_perf > S_OOS_perf) {
-         OOS_perf = test_system ( 1 , ncases , x , L_short_lookback , L_long_lookback ) ;
-         Bias = L_OOS_perf - OOS_perf ;  // This is the selection bias for this replication
-         }
-      else {
-         OOS_perf = test_system ( 0 , ncases , x , S_short_lookback , S_long_lookback ) ;
-         Bias = S_OOS_perf - OOS_perf ;  // This is the selection bias for this replication
-         }
-
-      Bias_mean += Bias ;
-      Bias_SS += Bias * Bias ;  // We'll need this for t-test
-      OOS_mean += OOS_perf ;    // This is the final OOS performance, with both training and selection bias removed
-      printf ( "\n     OOS_perf=%8.4lf  Bias=%8.4lf", OOS_perf, Bias ) ;
-      } // For irep
+   context.which = which ;
+   context.ncases = ncases ;
+   context.trend = save_trend ;
+
+   memset ( &study , 0 , sizeof(study) ) ;
+   study.nreps = nreps ;
+   study.nthreads = nthreads ;
+   study.seed = MWC256_DEFAULT_SEED ;
+   study.block = 1 ;            // Print every replication
+   study.work_bytes = ncases * sizeof(double) ;
+   study.acc_bytes = sizeof(SEL_ACC) ;
+   study.context = &context ;
+   study.rep = sel_rep ;
+   study.merge = sel_merge ;
+
+   if (mc_run ( &study , &total ) < 0) {
+      printf ( "\n\nInsufficient memory" ) ;
+      exit ( 1 ) ;
+      }
 
    // Done.  Print results and clean up.
 
-   L_IS_mean /= nreps ;   // These are for computing training bias
-   L_OOS_mean /= nreps ;  // We compute long and short separately
-   S_IS_mean /= nreps ;   // Because in general different competing models
-   S_OOS_mean /= nreps ;  // can have different training bias
+   L_IS_mean = total.L_IS_sum / nreps ;   // These are for computing training bias
+   L_OOS_mean = total.L_OOS_sum / nreps ; // We compute long and short separately
+   S_IS_mean = total.S_IS_sum / nreps ;   // Because in general different competing models
+   S_OOS_mean = total.S_OOS_sum / nreps ; // can have different training bias
 
    printf ( "\n\nLong training bias = %.4lf  short = %.4lf",
             L_IS_mean - L_OOS_mean, S_IS_mean - S_OOS_mean ) ;
 
-   OOS_mean /= nreps ;
-   Bias_mean /= nreps ;
-   Bias_SS /= nreps ;
+   OOS_mean = total.OOS_sum / nreps ;
+   Bias_mean = total.Bias_sum / nreps ;
+   Bias_SS = total.Bias_SS / nreps ;
    Bias_SS -= Bias_mean * Bias_mean ;  // This is the variance of the bias across replications
    if (Bias_SS < 1.e-20)  // Don't divide by zero or take sqrt of a negative number
       Bias_SS = 1.e-20 ;
@@ -394,7 +439,5 @@ int main (
    printf ( "\nOOS=%.4lf  Selection bias=%.4lf  t=%.3lf", OOS_mean, Bias_mean, t ) ;
    _getch () ;  // Wait for user to press a key
 
-   free ( x ) ;
-
    return 0 ;
 }